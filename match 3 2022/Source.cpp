@@ -1,8 +1,163 @@
 #include <SFML/Graphics.hpp>
 #include <SFML/Audio.hpp>
 #include <iostream>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <chrono>
+#include <cstring>
+#include <type_traits>
+#include <cmath>
+#include <functional>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <atomic>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <cerrno>
+#include <cassert>
+#include <new>
+#include <malloc.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//======================================================================================
+//              .: RANDOM NUMBERS :.
+//======================================================================================
+
+// xoshiro256** - small, fast and splittable, every owner gets its own instance
+// so boards, effects and parallel simulations never touch a shared hidden state
+class Random
+{
+public:
+    uint64_t state[4];
+
+    Random(uint64_t seed = 0)
+    {
+        this->seed(seed);
+    }
+
+    // seed through splitmix64 so nearby seeds still give unrelated streams
+    void seed(uint64_t seed)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            seed += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            this->state[i] = z ^ (z >> 31);
+        }
+    }
+
+    uint64_t next()
+    {
+        uint64_t result = rotl(this->state[1] * 5, 7) * 9;
+        uint64_t t = this->state[1] << 17;
+        this->state[2] ^= this->state[0];
+        this->state[3] ^= this->state[1];
+        this->state[1] ^= this->state[2];
+        this->state[0] ^= this->state[3];
+        this->state[2] ^= t;
+        this->state[3] = rotl(this->state[3], 45);
+        return result;
+    }
+
+    // uniform in [0, bound), multiply-shift instead of modulo
+    int nextInt(int bound)
+    {
+        return (int)(((this->next() >> 32) * (uint64_t)bound) >> 32);
+    }
+
+    // uniform in [0, 1)
+    float nextFloat()
+    {
+        return (this->next() >> 40) * (1.0f / 16777216.0f);
+    }
+
+    // advances the state by 2^128 draws, enough room for one stream per thread
+    void jump()
+    {
+        static const uint64_t JUMP[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+        uint64_t s[4] = { 0, 0, 0, 0 };
+        for (int i = 0; i < 4; i++)
+        {
+            for (int b = 0; b < 64; b++)
+            {
+                if (JUMP[i] & (1ULL << b))
+                {
+                    for (int k = 0; k < 4; k++) s[k] ^= this->state[k];
+                }
+                this->next();
+            }
+        }
+        for (int k = 0; k < 4; k++) this->state[k] = s[k];
+    }
+
+    // hands the current sequence to the caller and moves this one 2^128 draws ahead
+    Random split()
+    {
+        Random child = *this;
+        this->jump();
+        return child;
+    }
+
+    // numbered streams for a single seed, see RandomStream
+    static Random forStream(uint64_t seed, int stream)
+    {
+        Random r(seed);
+        for (int i = 0; i < stream; i++) r.jump();
+        return r;
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+};
+
+enum RandomStream
+{
+    STREAM_BOARD = 0,   // refills, must stay reproducible
+    STREAM_EFFECTS = 1, // particles and other cosmetics, free to vary
+    STREAM_LAYOUTS = 2, // one seed per generated board, known ahead so boards can be pregenerated
+    STREAM_PLAYERS = 3  // moves picked for simulated players on the session host
+};
+
+//======================================================================================
+//              .: VECTOR MATH :.
+//======================================================================================
+
+const float PI = 3.14159265358979f;
 
-// some utility moved to top for convenience
 sf::Vector2f lerp(sf::Vector2f A, sf::Vector2f B, float t)
 {
     return (1 - t) * A + t * B;
@@ -13,1070 +168,7683 @@ float norm(sf::Vector2f v)
     return std::sqrt(v.x * v.x + v.y * v.y);
 }
 
+// cos and sin read off a table of the unit circle and interpolated, within 1e-5 of the real thing
+class UnitCircle
+{
+public:
+    static const int STEPS = 1024;
+
+    UnitCircle()
+    {
+        for (int i = 0; i <= STEPS; i++)
+        {
+            double angle = 2.0 * 3.14159265358979323846 * i / STEPS;
+            this->points[i] = { (float)std::cos(angle), (float)std::sin(angle) };
+        }
+    }
+
+    // { cos, sin } of an angle given in turns, any value
+    sf::Vector2f turns(float angle) const
+    {
+        float position = (angle - std::floor(angle)) * STEPS;
+        int index = (int)position;
+        float fraction = position - index;
+        if (index >= STEPS)
+        {
+            index = STEPS - 1;
+            fraction = 1.0f;
+        }
+        const sf::Vector2f& a = this->points[index];
+        const sf::Vector2f& b = this->points[index + 1];
+        return { a.x + (b.x - a.x) * fraction, a.y + (b.y - a.y) * fraction };
+    }
+
+    sf::Vector2f radians(float angle) const
+    {
+        return this->turns(angle * (0.5f / PI));
+    }
+
+    // direction i out of count spread evenly around the circle
+    sf::Vector2f spread(int i, int count) const
+    {
+        return this->turns((float)i / count);
+    }
+
+private:
+    sf::Vector2f points[STEPS + 1];
+};
+const int UnitCircle::STEPS;
+const UnitCircle unitCircle;
+
+// angle in radians
 sf::Vector2f rotateVector(sf::Vector2f vector, float angle)
 {
-    float alpha = std::atan2(vector.y, vector.x);
-    return { norm(vector) * std::cos(alpha + angle), norm(vector) * std::sin(alpha + angle) };
+    sf::Vector2f turn = unitCircle.radians(angle);
+    return { vector.x * turn.x - vector.y * turn.y, vector.x * turn.y + vector.y * turn.x };
 }
 
-//======================================================================================
-//              .: GAME CONFIG AND DATA :.
-//======================================================================================
+// batch versions: plain loops over whole arrays with nothing in between. --math times them about level
+// with the per-vector calls, and normalizeBatch stays scalar because sqrt may set errno
+static_assert(sizeof(sf::Vector2f) == 2 * sizeof(float), "batch math reads vectors as packed floats");
 
-struct Config
+void lerpBatch(const sf::Vector2f* from, const sf::Vector2f* to, const float* t, sf::Vector2f* out, int count)
 {
-    float gameWidth{ 800 };
-    float gameHeight{ 600 };
-    float tileWidth{ 75 };
-    float swapDuration{ 0.2f };
-    float minx = 75.0f;
-    float miny = 75.0f;
-    float gridWidth = 7.0f;
-    float gridHeight = 7.0f;
-    float powerUpBomb = 10.0f;
+    for (int i = 0; i < count; i++)
+    {
+        out[i].x = (1 - t[i]) * from[i].x + t[i] * to[i].x;
+        out[i].y = (1 - t[i]) * from[i].y + t[i] * to[i].y;
+    }
+}
 
-    int tileTypes = 7;
+// zero vectors stay zero, in and out may be the same array
+void normalizeBatch(const sf::Vector2f* vectors, sf::Vector2f* out, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        float length = std::sqrt(vectors[i].x * vectors[i].x + vectors[i].y * vectors[i].y);
+        float scale = length > 0.0f ? 1.0f / length : 0.0f;
+        out[i].x = vectors[i].x * scale;
+        out[i].y = vectors[i].y * scale;
+    }
+}
+
+// ==========
+// Easing
+// ==========
 
-    bool logging = false;
+// t runs from 0 to 1 and so does the result, apart from the overshoot of OUT_BACK
+enum class Easing
+{
+    LINEAR,
+    IN_QUAD,
+    OUT_QUAD,
+    IN_OUT_CUBIC,
+    OUT_BACK,
+    OUT_BOUNCE
 };
-Config config;
 
-class Textures
+float ease(Easing easing, float t)
 {
-public:
-    sf::Texture* blueTexture;
-    sf::Texture* greenTexture;
-    sf::Texture* redTexture;
-    sf::Texture* wildcardTexture;
-    sf::Texture* yellowTexture;
-    sf::Texture* purpleTexture;
-    sf::Texture* bombTexture;
+    switch (easing)
+    {
+    case Easing::IN_QUAD:
+        return t * t;
+    case Easing::OUT_QUAD:
+        return t * (2.0f - t);
+    case Easing::IN_OUT_CUBIC:
+        return t < 0.5f ? 4.0f * t * t * t : 1.0f - 4.0f * (1.0f - t) * (1.0f - t) * (1.0f - t);
+    case Easing::OUT_BACK:
+    {
+        const float overshoot = 1.70158f;
+        float u = t - 1.0f;
+        return 1.0f + u * u * ((overshoot + 1.0f) * u + overshoot);
+    }
+    case Easing::OUT_BOUNCE:
+    {
+        const float n = 7.5625f;
+        if (t < 1.0f / 2.75f) return n * t * t;
+        if (t < 2.0f / 2.75f) { t -= 1.5f / 2.75f; return n * t * t + 0.75f; }
+        if (t < 2.5f / 2.75f) { t -= 2.25f / 2.75f; return n * t * t + 0.9375f; }
+        t -= 2.625f / 2.75f;
+        return n * t * t + 0.984375f;
+    }
+    default:
+        return t;
+    }
+}
 
-    sf::Texture* backgroundTexture;
-    sf::Texture* scoreTexture;
+void easeBatch(Easing easing, const float* t, float* out, int count)
+{
+    for (int i = 0; i < count; i++) out[i] = ease(easing, t[i]);
+}
 
-    sf::Texture* selectorTexture;
+// ==========
+// Math check
+// ==========
 
-    void loadTextures()
+// accuracy against the standard library and throughput against the plain versions, run with --math
+int checkMath()
+{
+    const int count = 1 << 16;
+    const int rounds = 64;
+    Random random(1);
+
+    std::vector<float> angles(count);
+    for (int i = 0; i < count; i++) angles[i] = (random.nextFloat() - 0.5f) * 8.0f * PI;
+    double worstTrig = 0.0;
+    for (int i = 0; i < count; i++)
     {
-        this->blueTexture = new sf::Texture();
-        (*this->blueTexture).loadFromFile("./assets/graphics/element_blue_polygon.png");
-        this->bombTexture = new sf::Texture();
-        (*this->bombTexture).loadFromFile("./assets/graphics/bomb.png");
-        this->greenTexture = new sf::Texture();
-        (*this->greenTexture).loadFromFile("./assets/graphics/element_green_polygon.png");
-        this->redTexture = new sf::Texture();
-        (*this->redTexture).loadFromFile("./assets/graphics/element_red_polygon.png");
-        this->wildcardTexture = new sf::Texture();
-        (*this->wildcardTexture).loadFromFile("./assets/graphics/element_grey_diamond.png");
-        this->yellowTexture = new sf::Texture();
-        (*this->yellowTexture).loadFromFile("./assets/graphics/element_yellow_polygon.png");
-        this->purpleTexture = new sf::Texture();
-        (*this->purpleTexture).loadFromFile("./assets/graphics/element_purple_polygon.png");
-        this->wildcardTexture = new sf::Texture();
-        (*this->wildcardTexture).loadFromFile("./assets/graphics/element_grey_polygon.png");
+        sf::Vector2f fast = unitCircle.radians(angles[i]);
+        worstTrig = std::max(worstTrig, std::max(std::abs(fast.x - std::cos((double)angles[i])), std::abs(fast.y - std::sin((double)angles[i]))));
+    }
+    double worstSpread = 0.0;
+    for (int n = 1; n <= 200; n++)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            sf::Vector2f fast = unitCircle.spread(i, n);
+            double angle = 2.0 * 3.14159265358979323846 * i / n;
+            worstSpread = std::max(worstSpread, std::max(std::abs(fast.x - std::cos(angle)), std::abs(fast.y - std::sin(angle))));
+        }
+    }
+    double worstRotation = 0.0;
+    for (int i = 0; i < count; i++)
+    {
+        sf::Vector2f v = { random.nextFloat() * 200.0f - 100.0f, random.nextFloat() * 200.0f - 100.0f };
+        sf::Vector2f turned = rotateVector(v, angles[i]);
+        double angle = std::atan2((double)v.y, (double)v.x) + angles[i];
+        double length = std::sqrt((double)v.x * v.x + (double)v.y * v.y);
+        double error = std::max(std::abs(turned.x - length * std::cos(angle)), std::abs(turned.y - length * std::sin(angle)));
+        worstRotation = std::max(worstRotation, length > 1.0 ? error / length : error);
+    }
+    bool trigAccurate = worstTrig < 1e-5 && worstSpread < 1e-5 && worstRotation < 1e-5;
+    std::cout << "sin/cos table: worst error " << worstTrig << ", spread directions " << worstSpread << ", rotations " << worstRotation << " (relative)" << std::endl;
 
-        this->backgroundTexture = new sf::Texture();
-        (*this->backgroundTexture).loadFromFile("./assets/graphics/bg.png");
-        this->scoreTexture = new sf::Texture();
-        (*this->scoreTexture).loadFromFile("./assets/graphics/score.png");
+    std::vector<sf::Vector2f> from(count), to(count), out(count), vectors(count);
+    std::vector<float> t(count), eased(count);
+    for (int i = 0; i < count; i++)
+    {
+        from[i] = { random.nextFloat() * 800.0f, random.nextFloat() * 600.0f };
+        to[i] = { random.nextFloat() * 800.0f, random.nextFloat() * 600.0f };
+        t[i] = random.nextFloat();
+        vectors[i] = i % 1000 == 0 ? sf::Vector2f(0.0f, 0.0f) : to[i] - from[i];
+    }
+    lerpBatch(&from[0], &to[0], &t[0], &out[0], count);
+    bool lerpMatches = true;
+    for (int i = 0; i < count; i++) lerpMatches = lerpMatches && out[i] == lerp(from[i], to[i], t[i]);
+    std::vector<sf::Vector2f> unit(count);
+    normalizeBatch(&vectors[0], &unit[0], count);
+    double worstLength = 0.0;
+    bool zerosKept = true;
+    for (int i = 0; i < count; i++)
+    {
+        if (vectors[i] == sf::Vector2f(0.0f, 0.0f)) zerosKept = zerosKept && unit[i] == vectors[i];
+        else worstLength = std::max(worstLength, std::abs(norm(unit[i]) - 1.0));
+    }
+    bool normalizeAccurate = zerosKept && worstLength < 1e-6;
+    std::cout << "batch lerp matches lerp: " << (lerpMatches ? "yes" : "no") << ", normalized length worst error " << worstLength
+        << (zerosKept ? "" : ", zero vectors NOT kept") << std::endl;
 
-        this->selectorTexture = new sf::Texture();
-        (*this->selectorTexture).loadFromFile("./assets/graphics/selectorA.png");
+    const Easing easings[] = { Easing::LINEAR, Easing::IN_QUAD, Easing::OUT_QUAD, Easing::IN_OUT_CUBIC, Easing::OUT_BACK, Easing::OUT_BOUNCE };
+    bool easingsSound = true;
+    for (int e = 0; e < 6; e++)
+    {
+        easingsSound = easingsSound && std::abs(ease(easings[e], 0.0f)) < 1e-6f && std::abs(ease(easings[e], 1.0f) - 1.0f) < 1e-6f;
+        for (int step = 1; step <= 100 && easings[e] != Easing::OUT_BACK && easings[e] != Easing::OUT_BOUNCE; step++)
+        {
+            easingsSound = easingsSound && ease(easings[e], step / 100.0f) >= ease(easings[e], (step - 1) / 100.0f);
+        }
+    }
+    std::cout << "easing curves start at 0, end at 1 and do not turn back: " << (easingsSound ? "yes" : "no") << std::endl;
+    bool accurate = trigAccurate && lerpMatches && normalizeAccurate && easingsSound;
+
+    // throughput, each against what the code did before
+    float sink = 0.0f;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            float alpha = std::atan2(from[i].y, from[i].x);
+            sink += norm(from[i]) * std::cos(alpha + angles[i]) + norm(from[i]) * std::sin(alpha + angles[i]);
+        }
+    }
+    double oldRotate = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            sf::Vector2f turned = rotateVector(from[i], angles[i]);
+            sink += turned.x + turned.y;
+        }
+    }
+    double newRotate = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < count; i++) out[i] = lerp(from[i], to[i], t[i]);
+        sink += out[r].x;
+    }
+    double scalarLerp = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        lerpBatch(&from[0], &to[0], &t[0], &out[0], count);
+        sink += out[r].x;
+    }
+    double batchLerp = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            float length = norm(vectors[i]);
+            unit[i] = length > 0.0f ? vectors[i] / length : vectors[i];
+        }
+        sink += unit[r].x;
+    }
+    double scalarNormalize = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        normalizeBatch(&vectors[0], &unit[0], count);
+        sink += unit[r].x;
     }
+    double batchNormalize = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        easeBatch(Easing::IN_OUT_CUBIC, &t[0], &eased[0], count);
+        sink += eased[r];
+    }
+    double batchEase = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double perItem = 1e9 / ((double)rounds * count);
+    std::cout << "rotate: " << oldRotate * perItem << " ns -> " << newRotate * perItem << " ns (" << oldRotate / newRotate << "x)" << std::endl;
+    std::cout << "lerp: " << scalarLerp * perItem << " ns -> " << batchLerp * perItem << " ns batched (" << scalarLerp / batchLerp << "x)" << std::endl;
+    std::cout << "normalize: " << scalarNormalize * perItem << " ns -> " << batchNormalize * perItem << " ns batched (" << scalarNormalize / batchNormalize << "x)" << std::endl;
+    std::cout << "ease in-out cubic: " << batchEase * perItem << " ns batched" << (sink == 12345.0f ? " " : "") << std::endl;
+    std::cout << (accurate ? "Math checks passed" : "Math checks FAILED") << std::endl;
+    return accurate ? 0 : 1;
+}
+
+//======================================================================================
+//              .: LOGGING :.
+//======================================================================================
+
+enum class LogLevel : uint8_t { Trace, Debug, Info, Warning, Error };
+enum class LogCategory : uint8_t { System, Input, Logic, Score, Audio, Render };
+const int LOG_CATEGORIES = (int)LogCategory::Render + 1;
+
+// one log line as it leaves the game thread: the format stays a pointer to the literal
+// and arguments are kept raw, the writer thread does all the text work later on
+struct LogRecord
+{
+    enum class ArgKind : uint8_t { Signed, Unsigned, Real, Text };
+    static const int MAX_ARGS = 8;
+    static const int TEXT_BYTES = 48;
+
+    int64_t micros;
+    const char* format;
+    LogLevel level;
+    LogCategory category;
+    uint8_t argCount;
+    uint8_t textUsed;
+    ArgKind kinds[MAX_ARGS];
+    union
+    {
+        int64_t i;
+        uint64_t u;
+        double d;
+        uint8_t text; // offset into text
+    } args[MAX_ARGS];
+    char text[TEXT_BYTES]; // strings are copied, their owners may be gone by the time this is written
 };
-Textures textures;
+const int LogRecord::MAX_ARGS;
+const int LogRecord::TEXT_BYTES;
 
-class Fonts
+// bounded multi producer ring with a sequence number per slot; producers claim a slot with a
+// single compare-exchange and give up when the ring is full, they never wait on the writer
+class LogRing
 {
 public:
-    sf::Font* defaultFont;
+    LogRing(int capacity)
+    {
+        this->capacity = 1;
+        while (this->capacity < capacity) this->capacity <<= 1;
+        this->slots.reset(new Slot[this->capacity]);
+        for (uint64_t i = 0; i < this->capacity; i++) this->slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
 
-    void loadFonts()
+    // returns the slot to fill, nullptr when full; publish() hands it over to the reader
+    LogRecord* claim(uint64_t& position)
+    {
+        position = this->head.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Slot& slot = this->slots[position & (this->capacity - 1)];
+            int64_t lag = (int64_t)(slot.sequence.load(std::memory_order_acquire) - position);
+            if (lag == 0)
+            {
+                if (this->head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) return &slot.record;
+            }
+            else if (lag < 0) return nullptr;
+            else position = this->head.load(std::memory_order_relaxed);
+        }
+    }
+
+    void publish(uint64_t position)
+    {
+        this->slots[position & (this->capacity - 1)].sequence.store(position + 1, std::memory_order_release);
+    }
+
+    // single reader
+    bool pop(LogRecord& record)
+    {
+        Slot& slot = this->slots[this->tail & (this->capacity - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != this->tail + 1) return false;
+        record = slot.record;
+        slot.sequence.store(this->tail + this->capacity, std::memory_order_release);
+        this->tail++;
+        return true;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<uint64_t> sequence;
+        LogRecord record;
+    };
+
+    uint64_t capacity;
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<uint64_t> head{ 0 };
+    uint64_t tail{ 0 };
+};
+
+// the game thread only checks the level and copies a record into the ring, a background
+// thread formats and prints in batches with one flush each, so a frame never waits on the console
+class Logger
+{
+public:
+    Logger(int capacity = 4096) : ring(capacity), start(std::chrono::steady_clock::now())
+    {
+        for (int c = 0; c < LOG_CATEGORIES; c++) this->categories[c] = true;
+    }
+
+    ~Logger()
+    {
+        this->stop();
+    }
+
+    void run()
+    {
+        if (this->writer.joinable()) return;
+        this->stopping = false;
+        this->writer = std::thread([this]() { this->writeLoop(); });
+    }
+
+    // prints whatever is still queued, also without a writer thread (command line tools)
+    void stop()
+    {
+        this->stopping = true;
+        if (this->writer.joinable()) this->writer.join();
+        this->drain();
+    }
+
+    bool enabled(LogLevel level, LogCategory category) const
+    {
+        return level >= this->threshold.load(std::memory_order_relaxed) && this->categories[(int)category].load(std::memory_order_relaxed);
+    }
+
+    void setLevel(LogLevel level)
+    {
+        this->threshold = level;
+    }
+
+    void setCategory(LogCategory category, bool on)
+    {
+        this->categories[(int)category] = on;
+    }
+
+    template <typename... Args>
+    void write(LogLevel level, LogCategory category, const char* format, const Args&... args)
+    {
+        static_assert(sizeof...(Args) <= LogRecord::MAX_ARGS, "too many log arguments");
+        uint64_t position;
+        LogRecord* record = this->ring.claim(position);
+        if (record == nullptr)
+        {
+            this->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        record->micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - this->start).count();
+        record->format = format;
+        record->level = level;
+        record->category = category;
+        record->argCount = 0;
+        record->textUsed = 0;
+        int expand[] = { 0, (pack(*record, args), 0)... };
+        (void)expand;
+        this->ring.publish(position);
+    }
+
+    uint64_t droppedRecords() const
+    {
+        return this->dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    LogRing ring;
+    std::chrono::steady_clock::time_point start;
+    std::atomic<LogLevel> threshold{ LogLevel::Info };
+    std::atomic<bool> categories[LOG_CATEGORIES];
+    std::atomic<uint64_t> dropped{ 0 };
+    uint64_t droppedReported{ 0 };
+    std::atomic<bool> stopping{ false };
+    std::thread writer;
+    std::mutex drainMutex; // stop() may drain while the writer is still finishing up
+    std::string line;
+
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type pack(LogRecord& record, T value)
+    {
+        record.kinds[record.argCount] = LogRecord::ArgKind::Signed;
+        record.args[record.argCount++].i = value;
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type pack(LogRecord& record, T value)
+    {
+        record.kinds[record.argCount] = LogRecord::ArgKind::Unsigned;
+        record.args[record.argCount++].u = value;
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type pack(LogRecord& record, T value)
+    {
+        record.kinds[record.argCount] = LogRecord::ArgKind::Real;
+        record.args[record.argCount++].d = value;
+    }
+
+    static void pack(LogRecord& record, const char* value)
+    {
+        record.kinds[record.argCount] = LogRecord::ArgKind::Text;
+        int room = LogRecord::TEXT_BYTES - 1 - record.textUsed;
+        if (room < 0)
+        {
+            // text is full, the argument prints as the empty string ending the last one
+            record.args[record.argCount++].text = record.textUsed - 1;
+            return;
+        }
+        int length = std::min((int)std::strlen(value), room);
+        record.args[record.argCount++].text = record.textUsed;
+        std::memcpy(record.text + record.textUsed, value, length);
+        record.textUsed += length;
+        record.text[record.textUsed++] = '\0';
+        assert(record.textUsed <= LogRecord::TEXT_BYTES);
+    }
+
+    static void pack(LogRecord& record, const std::string& value)
+    {
+        pack(record, value.c_str());
+    }
+
+    void writeLoop()
+    {
+        while (true)
+        {
+            bool last = this->stopping.load();
+            if (this->drain() == 0)
+            {
+                if (last) break;
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+    }
+
+    int drain()
+    {
+        std::lock_guard<std::mutex> lock(this->drainMutex);
+        static const char* LEVELS[] = { "trace", "debug", "info ", "warn ", "error" };
+        static const char* CATEGORIES[] = { "system", "input", "logic", "score", "audio", "render" };
+        int count = 0;
+        LogRecord record;
+        this->line.clear();
+        while (this->ring.pop(record))
+        {
+            char head[48];
+            std::snprintf(head, sizeof(head), "[%9.3f] %s %-6s ", record.micros / 1000000.0, LEVELS[(int)record.level], CATEGORIES[(int)record.category]);
+            this->line += head;
+            this->format(record);
+            this->line += '\n';
+            count++;
+        }
+        uint64_t dropped = this->dropped.load(std::memory_order_relaxed);
+        if (dropped != this->droppedReported)
+        {
+            this->line += "[log] " + std::to_string(dropped - this->droppedReported) + " records dropped, the ring was full\n";
+            this->droppedReported = dropped;
+        }
+        if (!this->line.empty())
+        {
+            std::cout.write(this->line.data(), this->line.size());
+            std::cout.flush();
+        }
+        return count;
+    }
+
+    // "{}" takes the next argument
+    void format(const LogRecord& record)
+    {
+        int next = 0;
+        for (const char* c = record.format; *c; c++)
+        {
+            if (c[0] != '{' || c[1] != '}' || next >= record.argCount)
+            {
+                this->line += *c;
+                continue;
+            }
+            c++;
+            switch (record.kinds[next])
+            {
+            case LogRecord::ArgKind::Signed: this->line += std::to_string(record.args[next].i); break;
+            case LogRecord::ArgKind::Unsigned: this->line += std::to_string(record.args[next].u); break;
+            case LogRecord::ArgKind::Real:
+            {
+                char number[32];
+                std::snprintf(number, sizeof(number), "%g", record.args[next].d);
+                this->line += number;
+                break;
+            }
+            case LogRecord::ArgKind::Text: this->line += record.text + record.args[next].text; break;
+            }
+            next++;
+        }
+    }
+};
+Logger logger;
+
+// arguments are only evaluated when the level and category are on
+#define LOG(level, category, ...) \
+    do { if (logger.enabled(LogLevel::level, LogCategory::category)) logger.write(LogLevel::level, LogCategory::category, __VA_ARGS__); } while (0)
+
+//======================================================================================
+//              .: TELEMETRY :.
+//======================================================================================
+
+// live heap as seen by operator new; blocks are measured by the allocator itself instead of a
+// size header, so memory that crosses into the SFML dlls can still be freed on either side.
+// opt-in: main() switches it on for the game on screen before the window opens, the headless tools
+// keep it off so their workers do not all update one cache line on every allocation
+struct HeapCounter
+{
+    std::atomic<bool> enabled{ false };
+    std::atomic<int64_t> bytes{ 0 };
+    std::atomic<int64_t> blocks{ 0 };
+};
+HeapCounter heapCounter;
+
+size_t heapBlockSize(void* block)
+{
+#ifdef _WIN32
+    return _msize(block);
+#else
+    return malloc_usable_size(block);
+#endif
+}
+
+enum AllocationPhase
+{
+    PHASE_OTHER = 0, // worker threads and anything outside a scope
+    PHASE_INPUT = 1,
+    PHASE_LOGIC = 2,
+    PHASE_EFFECTS = 3,
+    PHASE_PUBLISH = 4
+};
+const int ALLOCATION_PHASES = PHASE_PUBLISH + 1;
+
+// the phase the allocations of this thread are booked to, see AllocationScope
+thread_local AllocationPhase allocationPhase = PHASE_OTHER;
+
+// opt-in: off, it adds one relaxed load to operator new (next to the one for heapCounter). on, every
+// allocation is booked to the phase of its thread for the current frame and to its call site (the
+// return address out of operator new)
+struct AllocationTracker
+{
+    static const int SITES = 1024;
+
+    std::atomic<bool> enabled{ false };
+    std::atomic<uint64_t> count[ALLOCATION_PHASES]; // this frame
+    std::atomic<uint64_t> bytes[ALLOCATION_PHASES];
+    std::atomic<uint64_t> worstFrame{ 0 }; // most allocations in one frame since the last reset
+    std::atomic<uintptr_t> sites[SITES]; // open addressing, 0 is a free slot
+    std::atomic<uint64_t> siteCount[SITES];
+    std::atomic<uint64_t> siteBytes[SITES];
+
+    void record(size_t size, void* site)
+    {
+        this->count[allocationPhase].fetch_add(1, std::memory_order_relaxed);
+        this->bytes[allocationPhase].fetch_add(size, std::memory_order_relaxed);
+        uintptr_t address = (uintptr_t)site;
+        int slot = (int)((address * 0x9e3779b97f4a7c15ULL) >> 54) & (SITES - 1);
+        for (int probe = 0; probe < SITES; probe++, slot = (slot + 1) & (SITES - 1))
+        {
+            uintptr_t seen = this->sites[slot].load(std::memory_order_relaxed);
+            if (seen == 0 && this->sites[slot].compare_exchange_strong(seen, address, std::memory_order_relaxed)) seen = address;
+            if (seen != address) continue;
+            this->siteCount[slot].fetch_add(1, std::memory_order_relaxed);
+            this->siteBytes[slot].fetch_add(size, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    uint64_t frameCount() const
+    {
+        uint64_t total = 0;
+        for (int p = 0; p < ALLOCATION_PHASES; p++) total += this->count[p].load(std::memory_order_relaxed);
+        return total;
+    }
+
+    // starts the next frame, returns how many allocations the one just finished made
+    uint64_t endFrame()
+    {
+        uint64_t total = this->frameCount();
+        if (total > this->worstFrame.load(std::memory_order_relaxed)) this->worstFrame.store(total, std::memory_order_relaxed);
+        if (total > 0)
+        {
+            LOG(Debug, System, "Frame allocations: {} (input {}, logic {}, effects {}, publish {}, other {}), {} bytes", total,
+                this->count[PHASE_INPUT].load(), this->count[PHASE_LOGIC].load(), this->count[PHASE_EFFECTS].load(),
+                this->count[PHASE_PUBLISH].load(), this->count[PHASE_OTHER].load(),
+                this->bytes[PHASE_INPUT].load() + this->bytes[PHASE_LOGIC].load() + this->bytes[PHASE_EFFECTS].load() + this->bytes[PHASE_PUBLISH].load() + this->bytes[PHASE_OTHER].load());
+        }
+        for (int p = 0; p < ALLOCATION_PHASES; p++)
+        {
+            this->count[p].store(0, std::memory_order_relaxed);
+            this->bytes[p].store(0, std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    void reset()
+    {
+        for (int p = 0; p < ALLOCATION_PHASES; p++)
+        {
+            this->count[p].store(0, std::memory_order_relaxed);
+            this->bytes[p].store(0, std::memory_order_relaxed);
+        }
+        for (int i = 0; i < SITES; i++)
+        {
+            this->sites[i].store(0, std::memory_order_relaxed);
+            this->siteCount[i].store(0, std::memory_order_relaxed);
+            this->siteBytes[i].store(0, std::memory_order_relaxed);
+        }
+        this->worstFrame.store(0, std::memory_order_relaxed);
+    }
+
+    // the busiest call sites since the last reset, addresses resolve with the linker map or addr2line
+    void report(int top)
+    {
+        bool wasEnabled = this->enabled.exchange(false);
+        std::vector<int> order;
+        for (int i = 0; i < SITES; i++)
+        {
+            if (this->siteCount[i].load(std::memory_order_relaxed) > 0) order.push_back(i);
+        }
+        std::sort(order.begin(), order.end(), [this](int a, int b) { return this->siteCount[a].load() > this->siteCount[b].load(); });
+        for (int i = 0; i < order.size() && i < top; i++)
+        {
+            std::cout << "  " << (void*)this->sites[order[i]].load() << ": " << this->siteCount[order[i]].load() << " allocations, " << this->siteBytes[order[i]].load() << " bytes" << std::endl;
+        }
+        this->enabled = wasEnabled;
+    }
+};
+const int AllocationTracker::SITES;
+AllocationTracker allocationTracker;
+
+// books the allocations of this thread to a phase until the scope ends, enter() moves on to the next one
+class AllocationScope
+{
+public:
+    AllocationScope(AllocationPhase phase) :
+        previous{ allocationPhase }
+    {
+        allocationPhase = phase;
+    }
+
+    ~AllocationScope()
+    {
+        allocationPhase = this->previous;
+    }
+
+    void enter(AllocationPhase phase)
+    {
+        allocationPhase = phase;
+    }
+
+private:
+    AllocationPhase previous;
+};
+
+#ifdef _MSC_VER
+#define CALLER_ADDRESS() _ReturnAddress()
+#else
+#define CALLER_ADDRESS() __builtin_return_address(0)
+#endif
+
+void* allocate(size_t size, void* site)
+{
+    void* block = std::malloc(size ? size : 1);
+    if (block == nullptr) return nullptr;
+    if (heapCounter.enabled.load(std::memory_order_relaxed))
+    {
+        heapCounter.bytes.fetch_add(heapBlockSize(block), std::memory_order_relaxed);
+        heapCounter.blocks.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (allocationTracker.enabled.load(std::memory_order_relaxed)) allocationTracker.record(size, site);
+    return block;
+}
+
+void* operator new(size_t size)
+{
+    void* block = allocate(size, CALLER_ADDRESS());
+    if (block == nullptr) throw std::bad_alloc();
+    return block;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return allocate(size, CALLER_ADDRESS());
+}
+
+void operator delete(void* block) noexcept
+{
+    if (block == nullptr) return;
+    if (heapCounter.enabled.load(std::memory_order_relaxed))
+    {
+        heapCounter.bytes.fetch_sub(heapBlockSize(block), std::memory_order_relaxed);
+        heapCounter.blocks.fetch_sub(1, std::memory_order_relaxed);
+    }
+    std::free(block);
+}
+
+void* operator new[](size_t size)
+{
+    void* block = allocate(size, CALLER_ADDRESS());
+    if (block == nullptr) throw std::bad_alloc();
+    return block;
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return allocate(size, CALLER_ADDRESS()); }
+void operator delete[](void* block) noexcept { operator delete(block); }
+void operator delete(void* block, size_t) noexcept { operator delete(block); }
+void operator delete[](void* block, size_t) noexcept { operator delete(block); }
+void operator delete(void* block, const std::nothrow_t&) noexcept { operator delete(block); }
+void operator delete[](void* block, const std::nothrow_t&) noexcept { operator delete(block); }
+
+// fixed buckets, so recording is an increment and the whole thing can be copied out as bytes
+struct TelemetryHistogram
+{
+    static const int BUCKETS = 24;
+
+    uint32_t linear; // bucket b counts the value b, otherwise values below 2^b (bucket 0 is zero)
+    uint32_t unused;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[BUCKETS]; // the last bucket takes everything above
+
+    void add(uint64_t value)
+    {
+        int bucket = (int)value;
+        if (!this->linear)
+        {
+            bucket = 0;
+            while (bucket < BUCKETS && (value >> bucket) != 0) bucket++;
+        }
+        this->buckets[bucket < BUCKETS ? bucket : BUCKETS - 1]++;
+        this->count++;
+        this->sum += value;
+        if (value > this->max) this->max = value;
+    }
+
+    // upper bound of the bucket holding the given fraction of samples
+    uint64_t percentile(double fraction) const
+    {
+        uint64_t wanted = (uint64_t)std::ceil(fraction * this->count);
+        uint64_t seen = 0;
+        for (int b = 0; b < BUCKETS; b++)
+        {
+            seen += this->buckets[b];
+            if (seen >= wanted && seen > 0)
+            {
+                if (b == BUCKETS - 1) return this->max;
+                return this->linear ? b : (b == 0 ? 0 : (1ULL << b) - 1);
+            }
+        }
+        return this->max;
+    }
+};
+const int TelemetryHistogram::BUCKETS;
+
+// everything the ops monitor sees; written by the game thread only and exported once a frame
+struct Telemetry
+{
+    // counters, they only go up
+    uint64_t frames;
+    uint64_t ticks;
+    uint64_t swaps;
+    uint64_t cascades;
+    uint64_t tilesMatched;
+    uint64_t specialsCreated;
+    uint64_t specialsSetOff;
+    uint64_t reshuffles;
+    uint64_t newBoards;
+    uint64_t tilesCreated;
+    uint64_t wildcardsCreated;
+    uint64_t logRecordsDropped;
+
+    // gauges
+    int64_t score;
+    int64_t particlesAlive;
+    int64_t heapBytes;
+    int64_t heapBlocks;
+    int64_t particleQuality; // percent of the requested particles being granted
+
+    TelemetryHistogram frameMicros;
+    TelemetryHistogram tickMicros;
+    TelemetryHistogram matchScanNanos;
+    TelemetryHistogram cascadeDepth; // settles that cleared something after one swap
+
+    Telemetry()
+    {
+        std::memset(this, 0, sizeof(Telemetry));
+        this->cascadeDepth.linear = 1;
+    }
+};
+
+//======================================================================================
+//              .: FRAME ARENA :.
+//======================================================================================
+
+// bump allocator for buffers that live no longer than a frame or a resolution step. nothing is freed
+// one by one, an ArenaScope rewinds the arena to where it started, so scopes nest. whatever does not
+// fit goes to the heap and the arena grows past it the next time it is empty: once it has seen the
+// biggest step it stops touching the heap altogether
+class FrameArena
+{
+public:
+    static bool heapOnly; // every request goes to the heap, for timing the arena against it
+    static const size_t INITIAL_BYTES = 64 * 1024;
+
+    FrameArena() = default;
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    ~FrameArena()
+    {
+        ::operator delete(this->buffer);
+    }
+
+    // alignment is at most alignof(std::max_align_t), which is what the buffer starts on
+    void* allocate(size_t bytes, size_t alignment)
+    {
+        if (!heapOnly)
+        {
+            if (!this->buffer) this->grow(INITIAL_BYTES);
+            size_t start = (this->top + alignment - 1) & ~(alignment - 1);
+            if (start + bytes <= this->capacity)
+            {
+                this->top = start + bytes;
+                return this->buffer + start;
+            }
+            this->wanted = std::max(this->wanted, std::max(this->capacity * 2, start + bytes));
+            this->spills++;
+        }
+        return ::operator new(bytes);
+    }
+
+    // only the newest block is really given back, which is what a growing vector does
+    void deallocate(void* block, size_t bytes)
+    {
+        char* at = (char*)block;
+        if (at < this->buffer || at >= this->buffer + this->capacity)
+        {
+            ::operator delete(block);
+            return;
+        }
+        if (at + bytes == this->buffer + this->top) this->top = at - this->buffer;
+    }
+
+    size_t mark() const
+    {
+        return this->top;
+    }
+
+    void rewind(size_t mark)
+    {
+        this->top = mark;
+        if (this->top == 0 && this->wanted > this->capacity) this->grow(this->wanted);
+    }
+
+    size_t used() const
+    {
+        return this->top;
+    }
+
+    uint64_t spilled() const
+    {
+        return this->spills;
+    }
+
+private:
+    char* buffer{ nullptr };
+    size_t capacity{ 0 };
+    size_t top{ 0 };
+    size_t wanted{ 0 };
+    uint64_t spills{ 0 }; // requests that went to the heap because the arena was full
+
+    void grow(size_t bytes)
+    {
+        ::operator delete(this->buffer);
+        this->buffer = (char*)::operator new(bytes);
+        this->capacity = bytes;
+    }
+};
+bool FrameArena::heapOnly = false;
+const size_t FrameArena::INITIAL_BYTES;
+
+// one per thread, so simulations on worker threads never share one
+thread_local FrameArena frameArena;
+
+// everything allocated from the arena after the scope started is gone when it ends,
+// containers using the arena have to be declared inside the scope
+class ArenaScope
+{
+public:
+    ArenaScope(FrameArena& arena) :
+        arena{ &arena },
+        start{ arena.mark() }
+    {
+    }
+
+    ~ArenaScope()
+    {
+        this->arena->rewind(this->start);
+    }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+    FrameArena* arena;
+    size_t start;
+};
+
+// lets the standard containers draw from an arena
+template <typename T>
+struct ArenaAllocator
+{
+    typedef T value_type;
+
+    FrameArena* arena;
+
+    ArenaAllocator(FrameArena& arena) :
+        arena{ &arena }
+    {
+    }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) :
+        arena{ other.arena }
+    {
+    }
+
+    T* allocate(size_t count)
+    {
+        return (T*)this->arena->allocate(count * sizeof(T), alignof(T));
+    }
+
+    void deallocate(T* block, size_t count)
+    {
+        this->arena->deallocate(block, count * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.arena == b.arena;
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.arena != b.arena;
+}
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+//======================================================================================
+//              .: GAME CONFIG AND DATA :.
+//======================================================================================
+
+struct Config
+{
+    float gameWidth{ 800 };
+    float gameHeight{ 600 };
+    float tileWidth{ 75 };
+    float swapDuration{ 0.2f };
+    float minx = 75.0f;
+    float miny = 75.0f;
+    float gridWidth = 7.0f;
+    float gridHeight = 7.0f;
+    float powerUpBomb = 10.0f;
+
+    int tileTypes = 7;
+    int wildcardChance = 5; // percent of refilled tiles that come in as wildcards
+    int minimumLegalMoves = 3; // every generated board offers at least this many swaps
+    int pregeneratedBoards = 2; // boards kept ready in the background per config
+    int gravityThreadThreshold = 0; // boards with at least this many cells collapse columns on the job system, 0 never does. --benchmark shows where it starts to pay
+    uint64_t seed = 0; // 0 picks a fresh seed from the clock
+
+    bool recordReplay = true;
+    std::string replayPath = "last_game.m3r";
+    float botThinkTime = 0.1f; // seconds of search per move
+    int botRolloutDepth = 3;
+    float botExploration = 0.7f;
+    int botThreads = 0; // 0 uses every core
+
+    bool resumeGame = true; // continue from the autosave left by the last session
+    std::string snapshotPath = "autosave.m3s";
+
+    bool turbo = false; // resolve whole cascades at once without animating them
+
+    int hostSessions = 10000; // games run by --host
+    int hostThreads = 0; // 0 uses every core
+
+    std::string leaderboardPath = "leaderboard.m3l"; // checkpoint written by --host, empty turns it off
+    int leaderboardScoreRange = 1 << 20; // scores ranked exactly, the ones above share the top rank
+    std::string journalPath = "sessions.m3j"; // --host keeps its sessions here and continues them on the next run, empty turns it off
+    int journalSegmentBytes = 1 << 20; // a full segment is folded into the snapshot, so recovery redoes at most about this much
+
+    std::string botSocketPath = "match3.sock"; // --serve listens here and shares observations through <path>.obs
+    int botEnvironments = 4096; // most games a bot server keeps at once
+    int botObservationDepth = 4; // observations kept per game before its ring slot is reused
+    int botServerThreads = 0; // 0 uses every core
+
+    std::string telemetryPath = "telemetry.m3t"; // shared page read by --monitor, empty turns it off
+
+    float tickTime = 1.0f / 240.0f; // shortest simulation tick, whatever is left of it is slept off
+    bool verticalSync = true; // only holds up drawing, the simulation has its own thread
+    bool trackAllocations = false; // count heap allocations per frame and phase, reported to the debug log
+    bool frameArena = true; // transient logic buffers come from a per-thread bump arena, off sends them to the heap
+    int jobThreads = 0; // frame jobs (tile tweens, particles), 0 uses every core, 1 runs them in order on the main thread
+
+    int particleBudget = 3000; // most particles alive at once, across every effect
+    float particleFrameTime = 1.0f / 60.0f; // effects get thinner while frames take longer than this
+
+    bool logging = false; // debug level log lines, trace is still left out
+};
+Config config;
+
+class Textures
+{
+public:
+    sf::Texture* blueTexture;
+    sf::Texture* greenTexture;
+    sf::Texture* redTexture;
+    sf::Texture* wildcardTexture;
+    sf::Texture* yellowTexture;
+    sf::Texture* purpleTexture;
+    sf::Texture* bombTexture;
+    sf::Texture* lineClearTexture;
+    sf::Texture* colourClearTexture;
+
+    sf::Texture* backgroundTexture;
+    sf::Texture* scoreTexture;
+
+    sf::Texture* selectorTexture;
+
+    void loadTextures()
+    {
+        this->blueTexture = new sf::Texture();
+        (*this->blueTexture).loadFromFile("./assets/graphics/element_blue_polygon.png");
+        this->bombTexture = new sf::Texture();
+        (*this->bombTexture).loadFromFile("./assets/graphics/bomb.png");
+        this->lineClearTexture = new sf::Texture();
+        (*this->lineClearTexture).loadFromFile("./assets/graphics/element_grey_diamond.png");
+        this->colourClearTexture = new sf::Texture();
+        (*this->colourClearTexture).loadFromFile("./assets/graphics/element_grey_polygon_glossy.png");
+        this->greenTexture = new sf::Texture();
+        (*this->greenTexture).loadFromFile("./assets/graphics/element_green_polygon.png");
+        this->redTexture = new sf::Texture();
+        (*this->redTexture).loadFromFile("./assets/graphics/element_red_polygon.png");
+        this->wildcardTexture = new sf::Texture();
+        (*this->wildcardTexture).loadFromFile("./assets/graphics/element_grey_diamond.png");
+        this->yellowTexture = new sf::Texture();
+        (*this->yellowTexture).loadFromFile("./assets/graphics/element_yellow_polygon.png");
+        this->purpleTexture = new sf::Texture();
+        (*this->purpleTexture).loadFromFile("./assets/graphics/element_purple_polygon.png");
+        this->wildcardTexture = new sf::Texture();
+        (*this->wildcardTexture).loadFromFile("./assets/graphics/element_grey_polygon.png");
+
+        this->backgroundTexture = new sf::Texture();
+        (*this->backgroundTexture).loadFromFile("./assets/graphics/bg.png");
+        this->scoreTexture = new sf::Texture();
+        (*this->scoreTexture).loadFromFile("./assets/graphics/score.png");
+
+        this->selectorTexture = new sf::Texture();
+        (*this->selectorTexture).loadFromFile("./assets/graphics/selectorA.png");
+    }
+};
+Textures textures;
+
+class Fonts
+{
+public:
+    sf::Font* defaultFont;
+
+    void loadFonts()
+    {
+        this->defaultFont = new sf::Font();
+        this->defaultFont->loadFromFile("./assets/fonts/Roboto-Bold.ttf");
+    }
+};
+Fonts fontsLibrary;
+
+class GameAssets
+{
+public:
+    sf::Sprite backgroundSprite;
+    sf::Sprite scoreSprite;
+
+    void loadSprites()
+    {
+        this->backgroundSprite.setTexture(*textures.backgroundTexture);
+        this->backgroundSprite.setScale(config.tileWidth * config.gridWidth / this->backgroundSprite.getTexture()->getSize().x, config.tileWidth * (config.gridHeight + 1) / this->backgroundSprite.getTexture()->getSize().y);
+        this->backgroundSprite.setPosition({ config.minx - config.tileWidth / 2, config.miny - config.tileWidth / 2 });
+
+        this->scoreSprite.setTexture(*textures.scoreTexture);
+        this->scoreSprite.setScale(config.tileWidth * 2 / this->scoreSprite.getTexture()->getSize().x, config.tileWidth / this->scoreSprite.getTexture()->getSize().y);
+        this->scoreSprite.setPosition({ config.minx + config.tileWidth * config.gridWidth - config.tileWidth / 2, config.miny - config.tileWidth / 2 });
+    }
+};
+GameAssets gameAssets;
+
+class Event
+{
+public:
+    enum class EventType
+    {
+        EventMatch,
+        EventSound
+    };
+
+    Event(Event::EventType type, int payload):
+        type{ type },
+        payload{ payload }
+    {
+
+    }
+
+    EventType type;
+    int payload;
+};
+
+class SoundLibrary
+{
+public:
+    std::vector<sf::SoundBuffer*> soundBuffers;
+    std::vector<sf::Sound*> sounds;
+    enum SoundMapper
+    {
+        SOUND_MATCH
+    };
+
+    void loadSounds()
+    {
+        sf::SoundBuffer* s = new sf::SoundBuffer();
+        s->loadFromFile("./assets/sounds/impactBell_heavy_000.ogg");
+        soundBuffers.push_back(s);
+
+        sf::Sound* sound = new sf::Sound(*s);
+        sounds.push_back(sound);
+
+    }
+
+    void play(Event* e)
+    {
+        sounds[e->payload]->play();
+    }
+};
+SoundLibrary soundLibrary;
+
+//==============================================================================================
+//                                   .: CLASS - TILE :.
+//==============================================================================================
+
+std::vector<std::string> tileTypeToColor = { "RED", "GREEN", "BLUE", "YELLOW", "PURPLE", "WILDCARD", "BOMB", "LINE CLEAR", "COLOUR CLEAR" };
+
+class Tile: public sf::Drawable
+{
+public:
+    enum class TileType
+    {
+        RED = 0,
+        GREEN = 1,
+        BLUE = 2,
+        YELLOW = 3,
+        PURPLE = 4,
+        WILDCARD = 5,
+        BOMB = 6,
+        LINE_CLEAR = 7,
+        COLOUR_CLEAR = 8
+    };
+
+    sf::Texture* tileTexture;
+    TileType type;
+    sf::Sprite tileSprite;
+    sf::Vector2f position;
+    bool selected;
+    sf::Sprite selectorSprite;
+    bool moving;
+    float currentStep;
+    float totalDuration;
+    sf::Vector2f origin, destination;
+    bool dead;
+    int cell; // board cell this tile belongs to, see GameLogic
+
+    Tile()
+    {
+
+    }
+
+    Tile(TileType type, sf::Vector2f position, sf::Vector2f sizeInGameWorld)
+    {
+        this->type = type;
+        this->position = position;
+        this->selected = false;
+        this->moving = false;
+        this->currentStep = 0.0f;
+        this->totalDuration = 0.0f;
+        this->dead = false;
+        this->cell = -1;
+
+        this->tileSprite.setTexture(*this->getTextureForTile(type));
+        this->tileSprite.setOrigin(this->tileSprite.getTexture()->getSize().x / 2, this->tileSprite.getTexture()->getSize().y / 2);
+        this->tileSprite.setScale({ sizeInGameWorld.x / this->tileSprite.getTexture()->getSize().x , sizeInGameWorld.y / this->tileSprite.getTexture()->getSize().y});
+        this->tileSprite.setPosition(this->position);
+
+        this->selectorSprite.setTexture(*textures.selectorTexture);
+        this->selectorSprite.setOrigin(this->selectorSprite.getTexture()->getSize().x / 2, this->selectorSprite.getTexture()->getSize().y / 2);
+        this->selectorSprite.setScale({ sizeInGameWorld.x / this->selectorSprite.getTexture()->getSize().x , sizeInGameWorld.y / this->selectorSprite.getTexture()->getSize().y });
+        this->selectorSprite.setPosition(this->position);
+    }
+
+    void update(float dt)
+    {
+		if (this->moving)
+		{
+			this->currentStep += dt;
+			if (this->currentStep > this->totalDuration)
+			{
+				this->position = this->destination;
+				this->tileSprite.setPosition(this->position);
+				this->selectorSprite.setPosition(this->position);
+				this->currentStep = 0.0f;
+                this->totalDuration = 0.0f;
+				this->moving = false;
+                //std::cout << "Stopped moving" << std::endl;
+			}
+			else
+			{
+				this->position = lerp(this->origin, this->destination, this->currentStep / this->totalDuration);
+				this->tileSprite.setPosition(this->position);
+				this->selectorSprite.setPosition(this->position);
+			}
+		}
+        else
+        {
+			//std::cout << "Tile not moving" << std::endl;
+        }
+    }
+
+    void move(sf::Vector2f pos, float animationDuration)
+    {
+        this->origin = this->position;
+        this->destination = pos;
+        this->moving = true;
+        this->currentStep = 0.0f;
+        this->totalDuration = animationDuration;
+        //std::cout << "Started moving" << std::endl;
+    }
+
+    void undoMove()
+    {
+        this->destination = this->origin;
+        this->origin = this->position;
+        this->moving = true;
+        this->currentStep = 0.0f;
+    }
+
+    void draw(sf::RenderTarget& target, sf::RenderStates states) const
+    {
+        //if (this->type == Tile::TileType(0)) return;
+
+        target.draw(this->tileSprite);
+        if (this->selected)
+        {
+            target.draw(this->selectorSprite);
+        }
+    }
+
+    sf::Texture* getTextureForTile(Tile::TileType type)
+    {
+        switch (type)
+        {
+        case (Tile::TileType::BLUE):
+            return textures.blueTexture;
+        case (Tile::TileType::GREEN):
+            return textures.greenTexture;
+        case (Tile::TileType::RED):
+            return textures.redTexture;
+        case (Tile::TileType::WILDCARD):
+            return textures.wildcardTexture;
+        case (Tile::TileType::YELLOW):
+            return textures.yellowTexture;
+        case (Tile::TileType::BOMB):
+            return textures.bombTexture;
+        case (Tile::TileType::PURPLE):
+            return textures.purpleTexture;
+        case (Tile::TileType::LINE_CLEAR):
+            return textures.lineClearTexture;
+        case (Tile::TileType::COLOUR_CLEAR):
+            return textures.colourClearTexture;
+        //    return nullptr;
+        default:
+            ;
+        }
+    }
+
+    void select()
+    {
+        this->selected = true;
+    }
+
+    void deselect()
+    {
+        this->selected = false;
+    }
+
+    bool isSelected()
+    {
+        return this->selected;
+    }
+
+    bool operator==(Tile t)
+    {
+        return this->type == Tile::TileType::WILDCARD || t.type == Tile::TileType::WILDCARD || this->type == t.type;
+    }
+
+    bool isEmpty()
+    {
+        return this->type == Tile::TileType(0);
+    }
+
+    void markForDeath()
+    {
+        //this->selected = true;
+        this->dead = true;
+    }
+
+    bool isDead()
+    {
+        return this->dead;
+    }
+};
+
+const int TILE_TYPES = (int)Tile::TileType::COLOUR_CLEAR + 1;
+
+//============================================================================================
+//                    .: OBSERVERS & EVENTS :.
+//============================================================================================
+
+
+class Scoreboard
+{
+public:
+    int score{ 0 };
+    bool announce{ true }; // off for boards nobody is watching, e.g. host sessions
+
+    void add(int score)
+    {
+        this->score += score;
+        if (this->announce) LOG(Debug, Score, "Current score: {}", this->score);
+    }
+};
+Scoreboard scoreboard;
+
+class MatchEvent: public Event
+{
+public:
+    MatchEvent(Event::EventType type, int payload):
+        Event(type, payload)
+    {
+    }
+};
+
+class Observer
+{
+public:
+    virtual void onNotify(Event* event) = 0;
+};
+
+class Subject
+{
+public:
+    std::vector<Observer*> observers[10];
+    int numObservers{ 0 };
+
+    void addObserver(Observer* obs)
+    {
+        this->observers->push_back(obs);
+        this->numObservers++;
+    }
+
+    void notify(Event* event)
+    {
+        for (int i = 0; i < this->numObservers; i++)
+        {
+            (*this->observers)[i]->onNotify(event);
+        }
+    }
+};
+Subject eventWatcher;
+
+class MatchObserver : public Observer
+{
+public:
+    Scoreboard* scoreboard;
+    MatchObserver(Scoreboard& scoreboard)
+    {
+        this->scoreboard = &scoreboard;
+    }
+
+    virtual void onNotify(Event* event)
+    {
+        if (event->type == Event::EventType::EventMatch)
+        {
+            if (this->scoreboard->announce) LOG(Trace, Score, "Score event notification");
+            this->scoreboard->add(event->payload);
+
+        }
+    }
+};
+
+class SoundObserver : public Observer
+{
+public:
+    virtual void onNotify(Event* event)
+    {
+        if (event->type == Event::EventType::EventMatch)
+        {
+			LOG(Trace, Audio, "Sound event notification");
+            event->payload = SoundLibrary::SoundMapper::SOUND_MATCH;
+			soundLibrary.play(event);
+        }
+    }
+};
+
+//====================================================================================
+//                            .: PARTICLE SYSTEM :.
+//====================================================================================
+
+/*
+* a--b  texture polygon utility for textured particles
+* |  |
+* d--c
+*/
+class Quad
+{
+public:
+    sf::Vector2f a, b, c, d;
+    Quad() :
+        a{ sf::Vector2f({0.0f,0.0f}) },
+        b{ sf::Vector2f({0.0f,0.0f}) },
+        c{ sf::Vector2f({0.0f, 0.0f}) },
+        d{ sf::Vector2f({0.0f, 0.0f}) }
+    {
+    }
+
+    Quad(sf::Vector2f a, sf::Vector2f b, sf::Vector2f c, sf::Vector2f d) :
+        a{ a },
+        b{ b },
+        c{ c },
+        d{ d }
+    {};
+
+    Quad operator=(Quad other)
+    {
+        this->a = other.a;
+        this->b = other.b;
+        this->c = other.c;
+        this->d = other.d;
+        return *this;
+    }
+
+    void setCoords(sf::Vector2f a, sf::Vector2f b, sf::Vector2f c, sf::Vector2f d)
+    {
+        this->a = a;
+        this->b = b;
+        this->c = c;
+        this->d = d;
+    };
+
+};
+
+struct ParticleProperties
+{
+    sf::Vector2f position;
+    sf::Vector2f velocity;
+    sf::Vector2f acceleration;
+    sf::Color color;
+    float lifetime;
+    Quad textureCoords;
+    sf::Vector2f size;
+    float startingAlpha;
+    float endAlpha;
+};
+
+class IUpdatable
+{
+public:
+    void virtual update(float dt) = 0;
+};
+
+class IDrawable
+{
+public:
+    void virtual draw(sf::VertexArray& va) = 0;
+};
+
+class Entity : public IUpdatable
+{
+public:
+    sf::Vector2f position;
+    sf::Vector2f velocity;
+    sf::Vector2f acceleration;
+
+    Entity(sf::Vector2f position, sf::Vector2f velocity, sf::Vector2f acceleration) :
+        position{ position },
+        velocity{ velocity },
+        acceleration{ acceleration }
+    {};
+
+    virtual void update(float dt) override
+    {
+        this->velocity += this->acceleration * dt;
+        this->position += this->velocity * dt;
+    };
+};
+
+// ==========
+// Particles
+// ==========
+
+class Particle : public Entity, public IDrawable
+{
+public:
+    float lifetime;
+    float timeElapsed;
+    sf::Color color;
+    Quad textureCoords;
+    bool dead;
+    sf::Vector2f size;
+    float startingAlpha;
+    float endAlpha;
+
+    Particle(ParticleProperties props) :
+        Entity(props.position, props.velocity, props.acceleration),
+        lifetime{ props.lifetime },
+        color{ props.color },
+        textureCoords{ props.textureCoords },
+        size{ props.size },
+        startingAlpha{ props.startingAlpha },
+        endAlpha{ props.endAlpha }
+    {
+        this->dead = false;
+        this->timeElapsed = 0.0f;
+    }
+
+    void update(float dt)
+    {
+        this->Entity::update(dt);
+        this->timeElapsed += dt;
+        if (this->timeElapsed > this->lifetime)
+        {
+            this->dead = true;
+        }
+        this->color.a = startingAlpha + (startingAlpha - endAlpha > 0 ? -1 : 1) * (abs(startingAlpha - endAlpha)) * (this->timeElapsed / this->lifetime);
+    }
+
+    void draw(sf::VertexArray& va)
+    {
+        sf::Vertex quad[4];
+        this->write(quad);
+        for (int v = 0; v < 4; v++) va.append(quad[v]);
+    }
+
+    // the four corners into a slot of an already sized vertex array
+    void write(sf::Vertex* quad) const
+    {
+        quad[0] = sf::Vertex(this->position, this->color, this->textureCoords.a);
+        quad[1] = sf::Vertex(this->position + sf::Vector2f({ this->size.x, 0 }), this->color, this->textureCoords.b);
+        quad[2] = sf::Vertex(this->position + sf::Vector2f({ this->size.x, -this->size.y }), this->color, this->textureCoords.c);
+        quad[3] = sf::Vertex(this->position + sf::Vector2f({ 0, -this->size.y }), this->color, this->textureCoords.d);
+    }
+};
+
+class PixelFaderParticle : public Particle
+{
+public:
+    PixelFaderParticle(ParticleProperties props) :
+        Particle(props)
+    {}
+
+    void update(float dt)
+    {
+        this->Particle::update(dt);
+        this->color.a = 255 - (this->timeElapsed / this->lifetime) * 255;
+    }
+};
+
+// ==========
+// Budget
+// ==========
+
+enum ParticlePriority
+{
+    PRIORITY_COSMETIC = 0,
+    PRIORITY_NORMAL = 1,
+    PRIORITY_IMPORTANT = 2
+};
+
+// one cap for every effect on screen. emitters ask for particles and get fewer when the cap is
+// close (lower priorities hit their share of it first) or when frames have been running slow;
+// quality drops quickly while the frame time is over target and creeps back once there is headroom.
+// not thread safe: only the simulation thread, which owns the particle system, may touch it
+class ParticleBudget
+{
+public:
+    static const int WINDOW = 30; // frames averaged before quality moves
+
+    int cap;
+    float frameTarget;
+    float quality{ 1.0f }; // share of every request that is granted
+    float minimumQuality{ 0.1f };
+    int alive{ 0 };
+    float frameTimes[WINDOW];
+    int frameCount{ 0 };
+    float frameSum{ 0.0f };
+    std::thread::id owner; // set by the simulation thread when it starts, checked in debug builds
+
+    ParticleBudget(Config& config) :
+        cap{ config.particleBudget },
+        frameTarget{ config.particleFrameTime }
+    {
+        for (int i = 0; i < WINDOW; i++) this->frameTimes[i] = 0.0f;
+    }
+
+    bool onOwnerThread() const
+    {
+        return this->owner == std::thread::id() || this->owner == std::this_thread::get_id();
+    }
+
+    void frameTime(float dt)
+    {
+        assert(this->onOwnerThread());
+        int slot = this->frameCount % WINDOW;
+        this->frameSum += dt - this->frameTimes[slot];
+        this->frameTimes[slot] = dt;
+        this->frameCount++;
+        if (this->frameCount < WINDOW || this->frameCount % (WINDOW / 3) != 0) return;
+
+        float average = this->frameSum / WINDOW;
+        if (average > this->frameTarget * 1.1f) this->quality *= 0.8f;
+        else if (average < this->frameTarget * 0.9f) this->quality += 0.05f;
+        if (this->quality < this->minimumQuality) this->quality = this->minimumQuality;
+        if (this->quality > 1.0f) this->quality = 1.0f;
+    }
+
+    // how many of the wanted particles may be made, they count as alive until released
+    int grant(int wanted, ParticlePriority priority)
+    {
+        static const float SHARE[] = { 0.5f, 0.8f, 1.0f };
+        assert(this->onOwnerThread());
+        int count = (int)std::ceil(wanted * this->quality);
+        int room = (int)(this->cap * SHARE[priority]) - this->alive;
+        if (count > room) count = room;
+        if (count < 0) count = 0;
+        this->alive += count;
+        return count;
+    }
+
+    void release(int count)
+    {
+        assert(this->onOwnerThread());
+        this->alive -= count;
+    }
+};
+const int ParticleBudget::WINDOW;
+ParticleBudget particleBudget(config);
+
+// ==========
+// Emitters
+// ==========
+
+class ParticleSystem;
+
+class IEmitter : public IUpdatable
+{
+public:
+    void virtual init(ParticleSystem& ps) = 0;
+    void virtual update(float dt) = 0;
+    void virtual createParticle(std::vector<Particle*>& v) = 0;
+
+};
+
+class BaseEmitter : public IEmitter
+{
+public:
+    ParticleSystem* parentPS;
+    bool initialized;
+    sf::Vector2f position;
+    sf::Vector2f acceleration;
+    sf::Vector2f velocity;
+    float lifetime;
+    sf::Color color;
+    Quad textureCoords;
+    sf::Vector2f size;
+    float startingAlpha;
+    float endAlpha;
+
+    BaseEmitter(ParticleProperties props) :
+        position{ props.position },
+        velocity{ props.velocity },
+        acceleration{ props.acceleration },
+        lifetime{ props.lifetime },
+        color{ props.color },
+        textureCoords{ props.textureCoords },
+        size{ props.size },
+        startingAlpha{ props.startingAlpha },
+        endAlpha{ props.endAlpha }
+    {
+        this->initialized = false;
+        parentPS = nullptr;
+    }
+
+    void init(ParticleSystem& ps)
+    {
+        this->parentPS = &ps;
+        this->initialized = true;
+    }
+
+    void createParticle(std::vector<Particle*>& v)
+    {
+        if (this->initialized)
+        {
+            ParticleProperties props;
+            props.position = this->position;
+            props.velocity = this->velocity;
+            props.acceleration = this->acceleration;
+            props.color = this->color;
+            props.lifetime = this->lifetime;
+            props.textureCoords = this->textureCoords;
+            props.size = this->size;
+            props.startingAlpha = this->startingAlpha;
+            props.endAlpha = this->endAlpha;
+            if (particleBudget.grant(1, PRIORITY_IMPORTANT) == 0) return;
+            v.push_back(new Particle(props));
+        }
+    }
+
+    void update(float dt)
+    {
+    }
+
+    void updateFromParent(sf::Vector2f position)
+    {
+        this->position = position;
+    }
+};
+
+class ExplosionEmitter : public BaseEmitter
+{
+public:
+    int particlesNumber; // at full quality, the particle budget may hand out fewer
+    ParticlePriority priority;
+    Random* random;
+    ExplosionEmitter(ParticleProperties props, int particlesNumber, Random& random, ParticlePriority priority = PRIORITY_NORMAL) :
+        BaseEmitter(props),
+        particlesNumber{ particlesNumber },
+        priority{ priority },
+        random{ &random }
+    {}
+
+    void createParticle(std::vector<Particle*>& v)
+    {
+        int count = particleBudget.grant(this->particlesNumber, this->priority);
+        for (int i = 0; i < count; i++)
+        {
+            sf::Vector2f randomSpeed = unitCircle.spread(i, count) * (this->random->nextFloat() * 200);
+
+            ParticleProperties props;
+            props.position = this->position;
+            props.velocity = randomSpeed;
+            props.acceleration = { 0, 0 };
+            props.color = this->color;
+            props.lifetime = this->lifetime;
+            props.textureCoords = this->textureCoords;
+            props.size = this->size;
+            props.startingAlpha = this->startingAlpha;
+            props.endAlpha = this->endAlpha;
+            v.push_back(new Particle(props));
+        }
+    }
+};
+
+// ==========
+// ParticleSystem
+// ==========
+class ParticleSystem : public sf::Drawable, public Entity
+{
+public:
+    sf::Texture* texture;
+    BaseEmitter* emitter;
+    float timeAccumulator;
+    float particleRate;
+    float particleLifetime;
+    bool active;
+    bool firedParticles;
+    std::vector<Particle*> particles;
+    sf::VertexArray particlesVA;
+    sf::VertexArray triangle;
+    ParticleSystem(ParticleProperties props, BaseEmitter* emitter, float particleRate, sf::Texture* texture) :
+        Entity(props.position, props.velocity, props.acceleration),
+        particleLifetime{ props.lifetime },
+        emitter{ emitter },
+        particleRate{ particleRate },
+        timeAccumulator{ 0.0f },
+        texture{ texture },
+        active{ true },
+        firedParticles{ false }
+    {
+        this->particlesVA.setPrimitiveType(sf::PrimitiveType::Quads);
+        this->triangle.setPrimitiveType(sf::PrimitiveType::Triangles);
+    }
+
+    ~ParticleSystem()
+    {
+        //delete this->emitter;
+    }
+
+    void update(float dt)
+    {
+        this->begin(dt);
+        this->integrate(dt, 0, this->particles.size());
+    }
+
+    // the serial part of a frame: particles that died last frame go, the emitter fires and the
+    // vertex array is sized, after which integrate() can run on any split of the particles
+    void begin(float dt)
+    {
+        this->Entity::update(dt);
+        this->emitter->updateFromParent(this->position);
+        int kept = 0;
+        for (int i = 0; i < this->particles.size(); i++)
+        {
+            if (this->particles[i]->dead)
+            {
+                particleBudget.release(1);
+                delete this->particles[i];
+            }
+            else this->particles[kept++] = this->particles[i];
+        }
+        this->particles.resize(kept);
+
+        this->timeAccumulator += dt;
+        if (!this->firedParticles)
+        {
+            this->firedParticles = true;
+            this->emitter->createParticle(this->particles);
+        }
+
+        if (this->firedParticles && this->particles.size() == 0)
+        {
+            this->markForDeath();
+        }
+
+        this->triangle.clear();
+        if (sf::Keyboard::isKeyPressed(sf::Keyboard::Space))
+        {
+            this->triangle.append({ { this->position.x, this->position.y }, sf::Color::Yellow });
+            this->triangle.append({ { this->position.x + 5, this->position.y - 7 }, sf::Color::Yellow });
+            this->triangle.append({ { this->position.x - 5, this->position.y - 7 }, sf::Color::Yellow });
+        }
+
+        this->particlesVA.resize(this->particles.size() * 4);
+    }
+
+    // moves particles [begin, end) and writes their quads, touches nothing outside of them
+    void integrate(float dt, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            this->particles[i]->update(dt);
+            this->particles[i]->write(&this->particlesVA[i * 4]);
+        }
+    }
+
+    virtual void draw(sf::RenderTarget& target, sf::RenderStates states) const override
+    {
+        target.draw(this->triangle);
+        target.draw(this->particlesVA, this->texture);
+    }
+    
+    void markForDeath()
+    {
+        this->active = false;
+    }
+
+    bool isDead()
+    {
+        return !this->active;
+    }
+};
+
+//====================================================================================
+//                           .: UTILITY FUNCTIONS :.
+//====================================================================================
+
+sf::VertexArray createVertexArray(std::vector<sf::Vector2f> v, sf::Color color)
+{
+    sf::VertexArray va;
+    va.setPrimitiveType(sf::PrimitiveType::LinesStrip);
+    for (int i = 0; i < v.size(); i++)
+    {
+        va.append(sf::Vertex(v[i], color));
+    }
+    return va;
+}
+
+sf::Vector2f normalize(sf::Vector2f v)
+{
+    return v / std::sqrt(v.x * v.x + v.y * v.y);
+}
+
+float distanceBetweenPoints(sf::Vector2f A, sf::Vector2f B)
+{
+    return std::sqrt((B.x - A.x) * (B.x - A.x) + (B.y - A.y) * (B.y - A.y));
+}
+
+//====================================================================================
+//                           .: THREAD POOL :.
+//====================================================================================
+
+// fixed set of workers pulling from one shared queue
+class ThreadPool
+{
+public:
+    ThreadPool(int threads)
+    {
+        if (threads <= 0) threads = std::max(1, (int)std::thread::hardware_concurrency());
+        for (int i = 0; i < threads; i++)
+        {
+            this->workers.push_back(std::thread([this]() { this->work(); }));
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->wake.notify_all();
+        for (int i = 0; i < this->workers.size(); i++) this->workers[i].join();
+    }
+
+    int size() const
+    {
+        return this->workers.size();
+    }
+
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->tasks.push_back(std::move(task));
+        }
+        this->wake.notify_one();
+    }
+
+    // blocks until every submitted task has finished
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->idle.wait(lock, [this]() { return this->tasks.empty() && this->running == 0; });
+    }
+
+    // runs the oldest queued task on the calling thread, false when the queue was empty
+    bool runOne()
+    {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (this->tasks.empty()) return false;
+            task = std::move(this->tasks.front());
+            this->tasks.pop_front();
+            this->running++;
+        }
+        task();
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->running--;
+        }
+        this->idle.notify_all();
+        return true;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    int running{ 0 };
+    bool stopping{ false };
+
+    void work()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->wake.wait(lock, [this]() { return this->stopping || !this->tasks.empty(); });
+                if (this->tasks.empty()) return;
+                task = std::move(this->tasks.front());
+                this->tasks.pop_front();
+                this->running++;
+            }
+            task();
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->running--;
+            }
+            this->idle.notify_all();
+        }
+    }
+};
+
+// jobs of one batch still to finish; a batch can be waited on by itself while others keep running
+struct JobCounter
+{
+    std::atomic<int> pending{ 0 };
+
+    bool done() const
+    {
+        return this->pending.load(std::memory_order_acquire) == 0;
+    }
+};
+
+// data parallel frame work: parallelFor cuts a range into chunks, one job each, and every chunk counts
+// down the counter it was started with. the caller helps run queued jobs while it waits, so it is
+// one of the workers too. with one thread there is no pool and every chunk runs at once, in order
+class JobSystem
+{
+public:
+    JobSystem(int threads)
+    {
+        if (threads <= 0) threads = std::max(1, (int)std::thread::hardware_concurrency());
+        if (threads > 1) this->pool.reset(new ThreadPool(threads - 1));
+    }
+
+    int size() const
+    {
+        return this->pool ? this->pool->size() + 1 : 1;
+    }
+
+    // function(begin, end) for every chunk of at most grain items
+    template <typename Function>
+    void parallelFor(int count, int grain, JobCounter& counter, Function function)
+    {
+        if (grain < 1) grain = 1;
+        for (int begin = 0; begin < count; begin += grain)
+        {
+            int end = std::min(begin + grain, count);
+            if (!this->pool)
+            {
+                function(begin, end);
+                continue;
+            }
+            counter.pending.fetch_add(1, std::memory_order_relaxed);
+            JobCounter* done = &counter;
+            this->pool->submit([function, begin, end, done]()
+            {
+                function(begin, end);
+                done->pending.fetch_sub(1, std::memory_order_release);
+            });
+        }
+    }
+
+    void wait(JobCounter& counter)
+    {
+        while (!counter.done())
+        {
+            if (!this->pool->runOne()) std::this_thread::yield();
+        }
+    }
+
+private:
+    std::unique_ptr<ThreadPool> pool;
+};
+
+// hands whole values from one writer thread to one reader thread without locks: the writer fills its
+// own slot and swaps it into the middle, the reader swaps the middle out whenever something newer is
+// there. nobody ever waits, the reader simply always has the latest complete value
+template <typename T>
+class TripleBuffer
+{
+public:
+    // the writer's slot, it holds an old value and has to be filled in whole
+    T& back()
+    {
+        return this->slots[this->backIndex];
+    }
+
+    void publish()
+    {
+        this->backIndex = this->middle.exchange(this->backIndex | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // true when a newer value came in, front() is the latest either way
+    bool update()
+    {
+        if (!(this->middle.load(std::memory_order_relaxed) & FRESH)) return false;
+        this->frontIndex = this->middle.exchange(this->frontIndex, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    const T& front() const
+    {
+        return this->slots[this->frontIndex];
+    }
+
+private:
+    static const int INDEX = 3;
+    static const int FRESH = 4;
+
+    T slots[3];
+    int backIndex{ 0 };
+    std::atomic<int> middle{ 1 };
+    int frontIndex{ 2 };
+};
+
+// workers with a task deque each: a task is queued on the worker it is pinned to, which takes its own
+// tasks oldest first, and a worker that runs dry steals the newest task of another one
+class WorkStealingPool
+{
+public:
+    WorkStealingPool(int threads)
+    {
+        if (threads <= 0) threads = std::max(1, (int)std::thread::hardware_concurrency());
+        for (int i = 0; i < threads; i++) this->queues.push_back(std::unique_ptr<Queue>(new Queue()));
+        for (int i = 0; i < threads; i++)
+        {
+            this->workers.push_back(std::thread([this, i]() { this->work(i); }));
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->sleepLock);
+            this->stopping = true;
+        }
+        this->wake.notify_all();
+        for (int i = 0; i < this->workers.size(); i++) this->workers[i].join();
+    }
+
+    int size() const
+    {
+        return this->workers.size();
+    }
+
+    long long steals() const
+    {
+        return this->stolen;
+    }
+
+    void submit(int worker, std::function<void()> task)
+    {
+        Queue& queue = *this->queues[worker % this->queues.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        this->pending++;
+        {
+            std::lock_guard<std::mutex> lock(this->sleepLock);
+            this->queued++;
+            if (this->sleeping == 0) return;
+        }
+        this->wake.notify_all();
+    }
+
+    // blocks until every submitted task has finished
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(this->sleepLock);
+        this->idle.wait(lock, [this]() { return this->pending == 0; });
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::atomic<int> pending{ 0 }; // submitted and not finished
+    int queued{ 0 }; // waiting in a queue, guarded by sleepLock
+    int sleeping{ 0 };
+    bool stopping{ false };
+    std::atomic<long long> stolen{ 0 };
+
+    bool take(int self, std::function<void()>& task)
+    {
+        for (int k = 0; k < this->queues.size(); k++)
+        {
+            Queue& queue = *this->queues[(self + k) % this->queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+            if (k == 0)
+            {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            else
+            {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+                this->stolen++;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void work(int self)
+    {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(this->sleepLock);
+                this->sleeping++;
+                this->wake.wait(lock, [this]() { return this->stopping || this->queued > 0; });
+                this->sleeping--;
+                if (this->stopping) return;
+            }
+
+            std::function<void()> task;
+            while (this->take(self, task))
+            {
+                {
+                    std::lock_guard<std::mutex> lock(this->sleepLock);
+                    this->queued--;
+                }
+                task();
+                task = nullptr;
+                if (--this->pending == 0)
+                {
+                    std::lock_guard<std::mutex> lock(this->sleepLock);
+                    this->idle.notify_all();
+                }
+            }
+        }
+    }
+};
+
+//====================================================================================
+//                           .: BOARD & GRAVITY :.
+//====================================================================================
+
+struct BoardKernels;
+const BoardKernels* selectBoardKernels(int width, int height);
+
+// integer view of the play field, each cell holds a Tile::TileType or EMPTY
+class Board
+{
+public:
+    static const int EMPTY = -1;
+
+    int width;
+    int height;
+    std::vector<int> cells;
+    const BoardKernels* kernels; // match and move scans compiled for this size, nullptr for the generic ones
+
+    Board(int width, int height) :
+        width{ width },
+        height{ height },
+        cells(width * height, EMPTY),
+        kernels{ selectBoardKernels(width, height) }
+    {
+    }
+
+    int index(int column, int row) const
+    {
+        return column + row * this->width;
+    }
+
+    int& at(int column, int row)
+    {
+        return this->cells[this->index(column, row)];
+    }
+
+    int at(int column, int row) const
+    {
+        return this->cells[this->index(column, row)];
+    }
+};
+const int Board::EMPTY;
+
+// one entry per tile that actually changes cell during a collapse
+struct TileMove
+{
+    int column;
+    int fromRow;
+    int toRow;
+};
+
+// tile carried to another cell by a reshuffle, cells are board indices
+struct TileShuffle
+{
+    int from;
+    int to;
+};
+
+// new tile dropped in from above the board, spawnRow is negative (off screen)
+struct TileSpawn
+{
+    int column;
+    int row;
+    int spawnRow;
+    int type;
+};
+
+// decides what falls into the board, one per board so refills never share state
+class SpawnGenerator
+{
+public:
+    int baseTypes;
+    int wildcardChance;
+    float powerUpBomb;
+
+    Random random;
+
+    float createdTiles{ 0.0f };
+    float createdWildcardTiles{ 0.0f };
+
+    SpawnGenerator(Config& config, Random random) :
+        baseTypes{ config.tileTypes - 2 }, // no bombs or wildcards from the plain roll
+        wildcardChance{ config.wildcardChance },
+        powerUpBomb{ config.powerUpBomb },
+        random{ random }
+    {
+    }
+
+    int next(int& powerUpTracker)
+    {
+        int selector = this->random.nextInt(this->baseTypes);
+        this->createdTiles += 1.0f;
+        if (this->random.nextInt(100) >= 100 - this->wildcardChance)
+        {
+            selector = (int)Tile::TileType::WILDCARD;
+            this->createdWildcardTiles += 1.0f;
+        }
+        if (powerUpTracker >= this->powerUpBomb)
+        {
+            selector = (int)Tile::TileType::BOMB;
+            powerUpTracker = 0;
+        }
+        return selector;
+    }
+};
+
+// compacts every column in one bottom-up pass, then refills the holes from the top
+// one pool for every board big enough to collapse in parallel, started by the first of them
+JobSystem& gravityJobs()
+{
+    static JobSystem jobs(config.jobThreads);
+    return jobs;
+}
+
+class GravityEngine
+{
+public:
+    int threadThreshold;
+
+    GravityEngine(Config& config) :
+        threadThreshold{ config.gravityThreadThreshold }
+    {
+    }
+
+    void collapse(Board& board, SpawnGenerator& spawner, int& powerUpTracker, std::vector<TileMove>& moves, std::vector<TileSpawn>& spawns)
+    {
+        std::vector<int>& holes = this->holes;
+        holes.assign(board.width, 0);
+
+        int slices = 1;
+        if (this->threadThreshold > 0 && board.width * board.height >= this->threadThreshold) slices = std::min(gravityJobs().size(), board.width);
+
+        if (slices > 1)
+        {
+            // columns are independent, each job owns a contiguous slice and its own move list
+            this->sliceMoves.resize(slices);
+            int width = (board.width + slices - 1) / slices;
+            JobCounter sliced;
+            gravityJobs().parallelFor(slices, 1, sliced, [this, &board, &holes, width](int begin, int end)
+            {
+                for (int s = begin; s < end; s++)
+                {
+                    this->sliceMoves[s].clear();
+                    for (int column = s * width; column < std::min(board.width, (s + 1) * width); column++)
+                    {
+                        holes[column] = this->compactColumn(board, column, this->sliceMoves[s]);
+                    }
+                }
+            });
+            gravityJobs().wait(sliced);
+            for (int s = 0; s < slices; s++) moves.insert(moves.end(), this->sliceMoves[s].begin(), this->sliceMoves[s].end());
+        }
+        else
+        {
+            for (int column = 0; column < board.width; column++)
+            {
+                holes[column] = this->compactColumn(board, column, moves);
+            }
+        }
+
+        // refill stays serial and in column order so the spawn sequence does not depend on threading
+        for (int column = 0; column < board.width; column++)
+        {
+            for (int l = 1; l <= holes[column]; l++)
+            {
+                TileSpawn spawn;
+                spawn.column = column;
+                spawn.row = holes[column] - l;
+                spawn.spawnRow = -l;
+                spawn.type = spawner.next(powerUpTracker);
+                board.at(column, spawn.row) = spawn.type;
+                spawns.push_back(spawn);
+            }
+        }
+    }
+
+private:
+    std::vector<int> holes; // scratch, per column
+    std::vector<std::vector<TileMove>> sliceMoves; // scratch, per job
+
+    // returns the number of empty cells left at the top of the column
+    int compactColumn(Board& board, int column, std::vector<TileMove>& moves) const
+    {
+        int write = board.height - 1;
+        for (int row = board.height - 1; row >= 0; row--)
+        {
+            int& cell = board.at(column, row);
+            if (cell == Board::EMPTY) continue;
+            if (row != write)
+            {
+                board.at(column, write) = cell;
+                cell = Board::EMPTY;
+                moves.push_back({ column, row, write });
+            }
+            write--;
+        }
+        return write + 1;
+    }
+};
+
+// times a collapse of the same boards serially and on the job system, and checks both leave the same
+// board and moves. prints the smallest board the job system was faster on, for gravityThreadThreshold
+bool benchmarkGravity(Config& config)
+{
+    Random random(1);
+    bool agree = true;
+    int pays = 0;
+    Config serialConfig = config;
+    serialConfig.gravityThreadThreshold = 0;
+    Config pooledConfig = config;
+    pooledConfig.gravityThreadThreshold = 1;
+    GravityEngine serial(serialConfig);
+    GravityEngine pooled(pooledConfig);
+    std::vector<TileMove> serialMoves, pooledMoves;
+    std::vector<TileSpawn> serialSpawns, pooledSpawns;
+
+    for (int size = 32; size <= 512; size *= 2)
+    {
+        Board start(size, size);
+        for (int i = 0; i < start.cells.size(); i++) start.cells[i] = random.nextInt(3) == 0 ? (int)Board::EMPTY : random.nextInt(5);
+        Board serialBoard = start;
+        Board pooledBoard = start;
+        int rounds = std::max(4, (1 << 22) / (size * size));
+        double times[2] = { 0.0, 0.0 };
+        for (int r = 0; r < rounds; r++)
+        {
+            for (int way = 0; way < 2; way++)
+            {
+                Board& board = way == 0 ? serialBoard : pooledBoard;
+                std::vector<TileMove>& moves = way == 0 ? serialMoves : pooledMoves;
+                std::vector<TileSpawn>& spawns = way == 0 ? serialSpawns : pooledSpawns;
+                board.cells = start.cells;
+                moves.clear();
+                spawns.clear();
+                SpawnGenerator spawner(config, Random(r));
+                int tracker = 0;
+                std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+                (way == 0 ? serial : pooled).collapse(board, spawner, tracker, moves, spawns);
+                times[way] += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            }
+            agree = agree && serialBoard.cells == pooledBoard.cells && serialMoves.size() == pooledMoves.size() && serialSpawns.size() == pooledSpawns.size();
+            for (int m = 0; agree && m < serialMoves.size(); m++)
+            {
+                agree = serialMoves[m].column == pooledMoves[m].column && serialMoves[m].fromRow == pooledMoves[m].fromRow && serialMoves[m].toRow == pooledMoves[m].toRow;
+            }
+        }
+        if (pays == 0 && times[1] * 1.1 < times[0]) pays = size * size;
+        std::cout << "collapse " << size << "x" << size << ": " << times[0] * 1e6 / rounds << " us serial, " << times[1] * 1e6 / rounds << " us on "
+            << gravityJobs().size() << " threads (" << times[0] / times[1] << "x)" << std::endl;
+    }
+    if (gravityJobs().size() == 1) std::cout << "One thread, both collapses ran the serial loop" << std::endl;
+    else if (pays > 0) std::cout << "The job system collapses 10% faster from " << pays << " cells, a gravityThreadThreshold around there pays" << std::endl;
+    else std::cout << "The job system never collapsed 10% faster here, keep gravityThreadThreshold at 0" << std::endl;
+    std::cout << (agree ? "Serial and parallel collapses agree" : "Serial and parallel collapses DISAGREE") << std::endl;
+    return agree;
+}
+
+//====================================================================================
+//                           .: GAME LOGIC :.
+//====================================================================================
+
+// same rules as Tile::operator==, wildcards match anything but holes match nothing
+bool tilesMatch(int a, int b)
+{
+    if (a == Board::EMPTY || b == Board::EMPTY) return false;
+    return a == (int)Tile::TileType::WILDCARD || b == (int)Tile::TileType::WILDCARD || a == b;
+}
+
+int scoreForClearedTiles(int cleared)
+{
+    return cleared >= 3 ? cleared - 2 : 0;
+}
+
+// ==========
+// Rules
+// ==========
+
+// a match shape in rows of 'X' for tiles of the matched colour, 'O' for the tile that turns into the
+// special and '.' for cells outside the shape. rotations and mirror images are added when compiled
+struct ShapeRule
+{
+    const char* name;
+    const char* pattern; // rows separated by '/'
+    int creates; // special tile type left behind
+};
+
+// area hit by a special, centred on the special's cell
+struct BlastShape
+{
+    enum Kind
+    {
+        SQUARE,
+        CROSS,
+        DIAMOND,
+        ROW,
+        COLUMN
+    };
+
+    static const int EDGE = -1; // radius reaching past every board edge
+
+    Kind kind;
+    int radius;
+};
+
+const int BlastShape::EDGE;
+
+// calls visit(cell) for every board cell inside the shape and nothing else, the ranges are clipped
+// to the board first so the cost is the number of cells hit
+template <typename Visitor>
+void forEachBlastCell(const Board& board, int cell, BlastShape shape, Visitor visit)
+{
+    int column = cell % board.width;
+    int row = cell / board.width;
+    int reach = shape.radius == BlastShape::EDGE ? board.width + board.height : shape.radius;
+    int top = std::max(0, row - reach);
+    int bottom = std::min(board.height - 1, row + reach);
+    int left = std::max(0, column - reach);
+    int right = std::min(board.width - 1, column + reach);
+
+    switch (shape.kind)
+    {
+    case BlastShape::SQUARE:
+        for (int y = top; y <= bottom; y++)
+        {
+            for (int x = left; x <= right; x++) visit(board.index(x, y));
+        }
+        break;
+    case BlastShape::DIAMOND:
+        for (int y = top; y <= bottom; y++)
+        {
+            int span = reach - std::abs(y - row);
+            for (int x = std::max(0, column - span); x <= std::min(board.width - 1, column + span); x++) visit(board.index(x, y));
+        }
+        break;
+    case BlastShape::CROSS:
+        for (int x = left; x <= right; x++) visit(board.index(x, row));
+        for (int y = top; y <= bottom; y++)
+        {
+            if (y != row) visit(board.index(column, y));
+        }
+        break;
+    case BlastShape::ROW:
+        for (int x = left; x <= right; x++) visit(board.index(x, row));
+        break;
+    case BlastShape::COLUMN:
+        for (int y = top; y <= bottom; y++) visit(board.index(column, y));
+        break;
+    }
+}
+
+// a blast shape going off on a cell
+struct Blast
+{
+    int cell;
+    BlastShape shape;
+};
+
+// marks the union of any number of blasts in kill, each cell hit for the first time is listed once in affected.
+// holes are skipped, specials caught in the blasts are not set off - RuleSet::activate chains those
+void blastUnion(const Board& board, const Blast* blasts, int count, std::vector<char>& kill, std::vector<int>& affected)
+{
+    for (int b = 0; b < count; b++)
+    {
+        forEachBlastCell(board, blasts[b].cell, blasts[b].shape, [&](int cell)
+        {
+            if (kill[cell] || board.cells[cell] == Board::EMPTY) return;
+            kill[cell] = 1;
+            affected.push_back(cell);
+        });
+    }
+}
+
+// what a special tile does when it goes off
+struct SpecialRule
+{
+    enum Effect
+    {
+        AREA, // every tile in its blast shape
+        COLOUR // every tile of one colour
+    };
+
+    int type;
+    Effect effect;
+    BlastShape area;
+};
+
+// earlier shapes win when several fit the same tiles
+const ShapeRule shapeRules[] =
+{
+    { "5-line", "XXOXX", (int)Tile::TileType::COLOUR_CLEAR },
+    { "T", "XOX/.X./.X.", (int)Tile::TileType::BOMB },
+    { "L", "X../X../OXX", (int)Tile::TileType::BOMB },
+    { "4-line", "XOXX", (int)Tile::TileType::LINE_CLEAR },
+    { "square", "OX/XX", (int)Tile::TileType::BOMB }
+};
+
+constexpr SpecialRule specialRules[] =
+{
+    { (int)Tile::TileType::BOMB, SpecialRule::AREA, { BlastShape::SQUARE, 1 } },
+    { (int)Tile::TileType::LINE_CLEAR, SpecialRule::AREA, { BlastShape::CROSS, BlastShape::EDGE } },
+    { (int)Tile::TileType::COLOUR_CLEAR, SpecialRule::COLOUR, { BlastShape::SQUARE, 0 } }
+};
+
+constexpr bool isSpecialType(int type)
+{
+    for (int i = 0; i < sizeof(specialRules) / sizeof(specialRules[0]); i++)
+    {
+        if (specialRules[i].type == type) return true;
+    }
+    return false;
+}
+
+// special tile created where a shape was matched
+struct TileUpgrade
+{
+    int cell;
+    int type;
+};
+
+// one orientation of a shape, bit x of rows[y] is set when cell (x, y) belongs to it
+struct ShapeTemplate
+{
+    static const int MAX_SIZE = 5;
+
+    int rule; // index into shapeRules
+    int width;
+    int height;
+    uint64_t rows[MAX_SIZE];
+    int anchorColumn;
+    int anchorRow;
+
+    // the same cells as a list, so testing the shape is one shift and AND per cell
+    int cells;
+    int cellRow[MAX_SIZE * MAX_SIZE];
+    int cellColumn[MAX_SIZE * MAX_SIZE];
+};
+
+// de Bruijn lookup, bits must not be 0
+int lowestSetBit(uint64_t bits)
+{
+    static const int table[64] =
+    {
+        0, 1, 48, 2, 57, 49, 28, 3, 61, 58, 50, 42, 38, 29, 17, 4,
+        62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12, 5,
+        63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+        46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19, 9, 13, 8, 7, 6
+    };
+    return table[((bits & (0 - bits)) * 0x03f79d71b4cb0a89ULL) >> 58];
+}
+
+// the rule tables compiled for the board: shapes into bitmask templates, specials into a lookup by tile type
+class RuleSet
+{
+public:
+    std::vector<ShapeTemplate> templates; // in shapeRules order
+    int effectOf[TILE_TYPES]; // index into specialRules, -1 for plain tiles
+    int smallestShape{ ShapeTemplate::MAX_SIZE * ShapeTemplate::MAX_SIZE }; // fewer matched tiles than this can hold no shape
+
+    RuleSet()
+    {
+        for (int t = 0; t < TILE_TYPES; t++) this->effectOf[t] = -1;
+        for (int i = 0; i < sizeof(specialRules) / sizeof(specialRules[0]); i++) this->effectOf[specialRules[i].type] = i;
+        for (int i = 0; i < sizeof(shapeRules) / sizeof(shapeRules[0]); i++) this->compile(i);
+    }
+
+    bool isSpecial(int type) const
+    {
+        return type >= 0 && type < TILE_TYPES && this->effectOf[type] >= 0;
+    }
+
+    // picks out the shapes among the cells about to be cleared and appends the specials they leave.
+    // the matched tiles go into one row bitmask per colour and each template is tried on every column
+    // of a row at once, one pass down the board per template. a shape that fits takes its tiles out of the
+    // running, and its special lands on a preferred cell (the swapped tiles) when it covers one.
+    // boards wider than 64 only clear lines
+    void findShapes(const Board& board, const std::vector<char>& kill, int preferred, int alsoPreferred, std::vector<uint64_t>& masks, std::vector<TileUpgrade>& upgrades) const
+    {
+        const int colours = (int)Tile::TileType::WILDCARD;
+        if (board.width > 64) return;
+
+        masks.assign(colours * board.height, 0);
+        int matched = 0;
+        for (int i = 0; i < kill.size(); i++)
+        {
+            int type = board.cells[i];
+            if (!kill[i] || type > colours) continue;
+            uint64_t bit = 1ull << (i % board.width);
+            int row = i / board.width;
+            for (int c = 0; c < colours; c++)
+            {
+                if (type == c || type == colours) masks[c * board.height + row] |= bit;
+            }
+            matched++;
+        }
+        if (matched < this->smallestShape) return;
+
+        // templates outside, so a better shape further down still beats a worse one higher up
+        for (int t = 0; t < this->templates.size(); t++)
+        {
+            const ShapeTemplate& shape = this->templates[t];
+            if (shape.width > board.width) continue;
+            int positions = board.width - shape.width + 1;
+            uint64_t columns = positions >= 64 ? ~0ull : (1ull << positions) - 1;
+
+            for (int row = 0; row + shape.height <= board.height; row++)
+            {
+                // templates have no empty top row, so only colours with matched tiles on this row can start one
+                int present[colours];
+                int count = 0;
+                for (int c = 0; c < colours; c++)
+                {
+                    if (masks[c * board.height + row]) present[count++] = c;
+                }
+
+                for (int p = 0; p < count; p++)
+                {
+                    const uint64_t* rows = &masks[present[p] * board.height + row];
+                    for (uint64_t hits = fits(shape, rows) & columns; hits; hits = fits(shape, rows) & columns)
+                    {
+                        int column = lowestSetBit(hits);
+                        for (int r = 0; r < shape.height; r++)
+                        {
+                            for (int k = 0; k < colours; k++) masks[k * board.height + row + r] &= ~(shape.rows[r] << column);
+                        }
+
+                        int cell = board.index(column + shape.anchorColumn, row + shape.anchorRow);
+                        if (covers(board, shape, column, row, preferred)) cell = preferred;
+                        else if (covers(board, shape, column, row, alsoPreferred)) cell = alsoPreferred;
+                        upgrades.push_back({ cell, shapeRules[shape.rule].creates });
+                    }
+                }
+            }
+        }
+    }
+
+    // sets off every special among the cleared cells, then every special those reach, breadth first, so a
+    // whole chain resolves in one pass and each special goes off once. cells hit are marked in kill and
+    // appended to cleared. the first colour clear takes colourHint when it is a colour, any later one
+    // takes the most common colour still standing
+    void activate(const Board& board, std::vector<char>& kill, std::vector<int>& cleared, int colourHint, std::vector<int>& queue) const
+    {
+        queue.clear();
+        for (int i = 0; i < cleared.size(); i++)
+        {
+            if (this->isSpecial(board.cells[cleared[i]])) queue.push_back(cleared[i]);
+        }
+
+        for (int head = 0; head < queue.size(); head++)
+        {
+            int cell = queue[head];
+            const SpecialRule& rule = specialRules[this->effectOf[board.cells[cell]]];
+            switch (rule.effect)
+            {
+            case SpecialRule::AREA:
+                forEachBlastCell(board, cell, rule.area, [&](int target) { this->hit(board, kill, target, cleared, queue); });
+                break;
+            case SpecialRule::COLOUR:
+            {
+                int colour = colourHint >= 0 && colourHint < (int)Tile::TileType::WILDCARD ? colourHint : commonestColour(board, kill);
+                colourHint = -1;
+                if (colour < 0) break;
+                for (int i = 0; i < board.cells.size(); i++)
+                {
+                    if (board.cells[i] == colour) this->hit(board, kill, i, cleared, queue);
+                }
+                break;
+            }
+            }
+        }
+    }
+
+private:
+    void hit(const Board& board, std::vector<char>& kill, int cell, std::vector<int>& cleared, std::vector<int>& queue) const
+    {
+        if (kill[cell] || board.cells[cell] == Board::EMPTY) return;
+        kill[cell] = 1;
+        cleared.push_back(cell);
+        if (this->isSpecial(board.cells[cell])) queue.push_back(cell);
+    }
+
+    static int commonestColour(const Board& board, const std::vector<char>& kill)
+    {
+        const int colours = (int)Tile::TileType::WILDCARD;
+        int counts[colours] = { 0 };
+        for (int i = 0; i < board.cells.size(); i++)
+        {
+            if (!kill[i] && board.cells[i] >= 0 && board.cells[i] < colours) counts[board.cells[i]]++;
+        }
+        int best = -1;
+        for (int c = 0; c < colours; c++)
+        {
+            if (counts[c] > 0 && (best < 0 || counts[c] > counts[best])) best = c;
+        }
+        return best;
+    }
+
+    // bits of the columns where the whole shape sits on matched tiles, rows starts at the shape's top row
+    static uint64_t fits(const ShapeTemplate& shape, const uint64_t* rows)
+    {
+        uint64_t hits = ~0ull;
+        for (int i = 0; i < shape.cells; i++) hits &= rows[shape.cellRow[i]] >> shape.cellColumn[i];
+        return hits;
+    }
+
+    static bool covers(const Board& board, const ShapeTemplate& shape, int column, int row, int cell)
+    {
+        if (cell < 0) return false;
+        int x = cell % board.width - column;
+        int y = cell / board.width - row;
+        if (x < 0 || y < 0 || x >= shape.width || y >= shape.height) return false;
+        return (shape.rows[y] >> x) & 1;
+    }
+
+    // parses the pattern and adds each distinct rotation and mirror image as a template
+    void compile(int rule)
+    {
+        const int size = ShapeTemplate::MAX_SIZE;
+        char grid[size][size];
+        int width = 0, height = 0, column = 0;
+        for (int y = 0; y < size; y++) for (int x = 0; x < size; x++) grid[y][x] = '.';
+        for (const char* c = shapeRules[rule].pattern; ; c++)
+        {
+            if (*c == '/' || *c == 0)
+            {
+                width = std::max(width, column);
+                height++;
+                column = 0;
+                if (*c == 0) break;
+            }
+            else
+            {
+                grid[height][column++] = *c;
+            }
+        }
+
+        for (int orientation = 0; orientation < 8; orientation++)
+        {
+            bool mirrored = orientation >= 4;
+            int turns = orientation % 4;
+            ShapeTemplate shape{};
+            shape.rule = rule;
+            shape.width = turns % 2 ? height : width;
+            shape.height = turns % 2 ? width : height;
+
+            for (int y = 0; y < height; y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    if (grid[y][x] == '.') continue;
+                    int tx = mirrored ? width - 1 - x : x;
+                    int ty = y;
+                    int turnedHeight = height;
+                    for (int k = 0; k < turns; k++)
+                    {
+                        int nx = turnedHeight - 1 - ty;
+                        ty = tx;
+                        tx = nx;
+                        turnedHeight = k % 2 ? height : width;
+                    }
+                    shape.rows[ty] |= 1ull << tx;
+                    shape.cellRow[shape.cells] = ty;
+                    shape.cellColumn[shape.cells] = tx;
+                    shape.cells++;
+                    if (grid[y][x] == 'O')
+                    {
+                        shape.anchorColumn = tx;
+                        shape.anchorRow = ty;
+                    }
+                }
+            }
+
+            bool seen = false;
+            for (int t = 0; t < this->templates.size() && !seen; t++)
+            {
+                const ShapeTemplate& other = this->templates[t];
+                seen = other.rule == rule && other.width == shape.width && other.height == shape.height;
+                for (int r = 0; r < shape.height && seen; r++) seen = other.rows[r] == shape.rows[r];
+            }
+            if (!seen) this->templates.push_back(shape);
+            this->smallestShape = std::min(this->smallestShape, shape.cells);
+        }
+    }
+};
+
+// compiled once on first use, shared read only by every GameLogic and thread
+const RuleSet& standardRules()
+{
+    static const RuleSet rules;
+    return rules;
+}
+
+bool isSpecialTile(int type)
+{
+    return standardRules().isSpecial(type);
+}
+
+// ==========
+// Matching
+// ==========
+
+// true when one of the three horizontal or three vertical windows covering the cell is a match
+bool lineThrough(const Board& board, int column, int row)
+{
+    for (int start = column - 2; start <= column; start++)
+    {
+        if (start < 0 || start + 2 >= board.width) continue;
+        int a = board.at(start, row), b = board.at(start + 1, row), c = board.at(start + 2, row);
+        if (tilesMatch(a, b) && tilesMatch(b, c) && tilesMatch(a, c)) return true;
+    }
+    for (int start = row - 2; start <= row; start++)
+    {
+        if (start < 0 || start + 2 >= board.height) continue;
+        int a = board.at(column, start), b = board.at(column, start + 1), c = board.at(column, start + 2);
+        if (tilesMatch(a, b) && tilesMatch(b, c) && tilesMatch(a, c)) return true;
+    }
+    return false;
+}
+
+struct SwapMove
+{
+    int from;
+    int to;
+};
+
+// calls visit(move) for every swap GameLogic would accept until it returns false:
+// special tiles always go off, anything else has to line up three
+template <typename Visitor>
+void forEachLegalMove(Board& board, Visitor visit)
+{
+    for (int row = 0; row < board.height; row++)
+    {
+        for (int column = 0; column < board.width; column++)
+        {
+            int here = board.index(column, row);
+            if (board.cells[here] == Board::EMPTY) continue;
+
+            for (int direction = 0; direction < 2; direction++)
+            {
+                int x = column + (direction == 0 ? 1 : 0);
+                int y = row + (direction == 0 ? 0 : 1);
+                if (x >= board.width || y >= board.height) continue;
+                int there = board.index(x, y);
+                if (board.cells[there] == Board::EMPTY) continue;
+
+                if (isSpecialTile(board.cells[here]) || isSpecialTile(board.cells[there]))
+                {
+                    if (!visit(SwapMove{ here, there })) return;
+                    continue;
+                }
+
+                std::swap(board.cells[here], board.cells[there]);
+                bool found = lineThrough(board, column, row) || lineThrough(board, x, y);
+                std::swap(board.cells[here], board.cells[there]);
+                if (found && !visit(SwapMove{ here, there })) return;
+            }
+        }
+    }
+}
+
+void legalMovesGeneric(Board& board, std::vector<SwapMove>& moves)
+{
+    moves.clear();
+    forEachLegalMove(board, [&moves](SwapMove move) { moves.push_back(move); return true; });
+}
+
+// stops counting at limit
+int countLegalMovesGeneric(Board& board, int limit)
+{
+    int count = 0;
+    forEachLegalMove(board, [&count, limit](SwapMove) { return ++count < limit; });
+    return count;
+}
+
+// marks every cell that takes part in a line of three, returns how many lines were found
+int findMatchesGeneric(const Board& board, std::vector<char>& kill)
+{
+    kill.assign(board.cells.size(), 0);
+    int lines = 0;
+    for (int row = 0; row < board.height; row++)
+    {
+        for (int column = 0; column < board.width; column++)
+        {
+            int tile = board.at(column, row);
+            if (tile == Board::EMPTY) continue;
+
+            if (column >= 2)
+            {
+                int leftOne = board.at(column - 1, row);
+                int leftTwo = board.at(column - 2, row);
+                if (tilesMatch(tile, leftOne) && tilesMatch(tile, leftTwo) && tilesMatch(leftOne, leftTwo))
+                {
+                    kill[board.index(column, row)] = kill[board.index(column - 1, row)] = kill[board.index(column - 2, row)] = 1;
+                    lines++;
+                }
+            }
+
+            if (row >= 2)
+            {
+                int topOne = board.at(column, row - 1);
+                int topTwo = board.at(column, row - 2);
+                if (tilesMatch(tile, topOne) && tilesMatch(tile, topTwo) && tilesMatch(topOne, topTwo))
+                {
+                    kill[board.index(column, row)] = kill[board.index(column, row - 1)] = kill[board.index(column, row - 2)] = 1;
+                    lines++;
+                }
+            }
+        }
+    }
+    return lines;
+}
+
+// ==========
+// Fixed size kernels
+// ==========
+
+// the scans one board size was compiled for, picked by the Board constructor
+struct BoardKernels
+{
+    int width;
+    int height;
+    int (*findMatches)(const Board& board, std::vector<char>& kill);
+    int (*countLegalMoves)(Board& board, int limit);
+    void (*legalMoves)(Board& board, std::vector<SwapMove>& moves);
+};
+
+// cell index tables for one board size, built by the compiler. tiles are looked up as type + 1 so EMPTY is slot 0
+template <int W, int H, int Types>
+struct FixedBoardTables
+{
+    static const int CELLS = W * H;
+    static const int WINDOWS = (W - 2) * H + W * (H - 2); // lines of three, horizontal ones first
+    static const int PAIRS = (W - 1) * H + W * (H - 1); // neighbour swaps, in forEachLegalMove order
+    static const int PAIR_WINDOWS = 10; // most windows a swap can touch
+    static const int TILES = Types + 1;
+
+    short window[WINDOWS][3];
+    short pair[PAIRS][2];
+    short pairWindow[PAIRS][PAIR_WINDOWS];
+    unsigned char pairWindows[PAIRS];
+    bool match[TILES][TILES];
+    bool special[TILES];
+
+    constexpr FixedBoardTables() :
+        window{}, pair{}, pairWindow{}, pairWindows{}, match{}, special{}
+    {
+        int w = 0;
+        for (int row = 0; row < H; row++)
+        {
+            for (int start = 0; start + 2 < W; start++, w++)
+            {
+                for (int k = 0; k < 3; k++) this->window[w][k] = (short)(start + k + row * W);
+            }
+        }
+        for (int start = 0; start + 2 < H; start++)
+        {
+            for (int column = 0; column < W; column++, w++)
+            {
+                for (int k = 0; k < 3; k++) this->window[w][k] = (short)(column + (start + k) * W);
+            }
+        }
+
+        int p = 0;
+        for (int row = 0; row < H; row++)
+        {
+            for (int column = 0; column < W; column++)
+            {
+                for (int direction = 0; direction < 2; direction++)
+                {
+                    int x = column + (direction == 0 ? 1 : 0);
+                    int y = row + (direction == 0 ? 0 : 1);
+                    if (x >= W || y >= H) continue;
+                    this->pair[p][0] = (short)(column + row * W);
+                    this->pair[p][1] = (short)(x + y * W);
+                    this->addCellWindows(p, column, row);
+                    this->addCellWindows(p, x, y);
+                    p++;
+                }
+            }
+        }
+
+        for (int a = 0; a < TILES; a++)
+        {
+            for (int b = 0; b < TILES; b++)
+            {
+                const int wildcard = (int)Tile::TileType::WILDCARD + 1;
+                this->match[a][b] = a > 0 && b > 0 && (a == wildcard || b == wildcard || a == b);
+            }
+            this->special[a] = a > 0 && isSpecialType(a - 1);
+        }
+    }
+
+    constexpr void addCellWindows(int p, int column, int row)
+    {
+        for (int start = column - 2; start <= column; start++)
+        {
+            if (start >= 0 && start + 2 < W) this->addPairWindow(p, start + row * (W - 2));
+        }
+        for (int start = row - 2; start <= row; start++)
+        {
+            if (start >= 0 && start + 2 < H) this->addPairWindow(p, (W - 2) * H + column + start * W);
+        }
+    }
+
+    constexpr void addPairWindow(int p, int w)
+    {
+        for (int i = 0; i < this->pairWindows[p]; i++)
+        {
+            if (this->pairWindow[p][i] == w) return;
+        }
+        this->pairWindow[p][this->pairWindows[p]++] = (short)w;
+    }
+};
+
+// findMatches and the legal move scans for one board size: loops run over the tables above with
+// compile-time trip counts, tile comparisons are table lookups and kill marks are written without branching.
+// results and move order are the same as the generic versions
+template <int W, int H, int Types>
+class FixedBoard
+{
+public:
+    typedef FixedBoardTables<W, H, Types> Tables;
+
+    static constexpr Tables tables{};
+    static const BoardKernels kernels;
+
+    // hits go to a local array first: stores into kill could alias the board for all the compiler knows
+    static int findMatches(const Board& board, std::vector<char>& kill)
+    {
+        kill.assign(Tables::CELLS, 0);
+        const int* cells = board.cells.data();
+        bool hits[Tables::WINDOWS];
+        int lines = 0;
+        for (int w = 0; w < Tables::WINDOWS; w++)
+        {
+            const short* window = tables.window[w];
+            int a = cells[window[0]] + 1, b = cells[window[1]] + 1, c = cells[window[2]] + 1;
+            hits[w] = tables.match[a][b] & tables.match[b][c] & tables.match[a][c];
+            lines += hits[w];
+        }
+        if (lines == 0) return 0;
+
+        char* marks = kill.data();
+        for (int w = 0; w < Tables::WINDOWS; w++)
+        {
+            if (!hits[w]) continue;
+            marks[tables.window[w][0]] = marks[tables.window[w][1]] = marks[tables.window[w][2]] = 1;
+        }
+        return lines;
+    }
+
+    template <typename Visitor>
+    static void forEachLegalMove(Board& board, Visitor visit)
+    {
+        int* cells = board.cells.data();
+        for (int p = 0; p < Tables::PAIRS; p++)
+        {
+            int here = tables.pair[p][0], there = tables.pair[p][1];
+            int a = cells[here], b = cells[there];
+            if (a == Board::EMPTY || b == Board::EMPTY) continue;
+            if (tables.special[a + 1] | tables.special[b + 1])
+            {
+                if (!visit(SwapMove{ here, there })) return;
+                continue;
+            }
+
+            cells[here] = b;
+            cells[there] = a;
+            bool found = false;
+            for (int i = 0; i < tables.pairWindows[p]; i++)
+            {
+                const short* window = tables.window[tables.pairWindow[p][i]];
+                int x = cells[window[0]] + 1, y = cells[window[1]] + 1, z = cells[window[2]] + 1;
+                found |= tables.match[x][y] & tables.match[y][z] & tables.match[x][z];
+            }
+            cells[here] = a;
+            cells[there] = b;
+            if (found && !visit(SwapMove{ here, there })) return;
+        }
+    }
+
+    static int countLegalMoves(Board& board, int limit)
+    {
+        int count = 0;
+        forEachLegalMove(board, [&count, limit](SwapMove) { return ++count < limit; });
+        return count;
+    }
+
+    static void legalMoves(Board& board, std::vector<SwapMove>& moves)
+    {
+        moves.clear();
+        forEachLegalMove(board, [&moves](SwapMove move) { moves.push_back(move); return true; });
+    }
+};
+
+template <int W, int H, int Types>
+constexpr FixedBoardTables<W, H, Types> FixedBoard<W, H, Types>::tables;
+
+template <int W, int H, int Types>
+const BoardKernels FixedBoard<W, H, Types>::kernels = { W, H, &FixedBoard<W, H, Types>::findMatches, &FixedBoard<W, H, Types>::countLegalMoves, &FixedBoard<W, H, Types>::legalMoves };
+
+// the common board sizes, anything else runs the generic scans
+template class FixedBoard<7, 7, TILE_TYPES>;
+template class FixedBoard<8, 8, TILE_TYPES>;
+template class FixedBoard<9, 9, TILE_TYPES>;
+template class FixedBoard<10, 10, TILE_TYPES>;
+
+const BoardKernels* selectBoardKernels(int width, int height)
+{
+    static const BoardKernels* fixed[] =
+    {
+        &FixedBoard<7, 7, TILE_TYPES>::kernels,
+        &FixedBoard<8, 8, TILE_TYPES>::kernels,
+        &FixedBoard<9, 9, TILE_TYPES>::kernels,
+        &FixedBoard<10, 10, TILE_TYPES>::kernels
+    };
+    for (int i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++)
+    {
+        if (fixed[i]->width == width && fixed[i]->height == height) return fixed[i];
+    }
+    return nullptr;
+}
+
+void legalMoves(Board& board, std::vector<SwapMove>& moves)
+{
+    if (board.kernels) board.kernels->legalMoves(board, moves);
+    else legalMovesGeneric(board, moves);
+}
+
+// stops counting at limit
+int countLegalMoves(Board& board, int limit)
+{
+    if (board.kernels) return board.kernels->countLegalMoves(board, limit);
+    return countLegalMovesGeneric(board, limit);
+}
+
+bool matchPossible(Board& board)
+{
+    return countLegalMoves(board, 1) > 0;
+}
+
+int findMatches(const Board& board, std::vector<char>& kill)
+{
+    if (board.kernels) return board.kernels->findMatches(board, kill);
+    return findMatchesGeneric(board, kill);
+}
+
+// ==========
+// Board generator
+// ==========
+
+struct GeneratorSettings
+{
+    int width;
+    int height;
+    int baseTypes;
+    int minimumMoves;
+
+    GeneratorSettings(Config& config) :
+        width{ (int)config.gridWidth },
+        height{ (int)config.gridHeight },
+        baseTypes{ config.tileTypes - 2 }, // plain colours only, like the refill roll
+        minimumMoves{ config.minimumLegalMoves }
+    {
+        assert(this->baseTypes >= 3); // fewer colours cannot always avoid a line, see generateBoard
+    }
+
+    bool operator<(const GeneratorSettings& other) const
+    {
+        if (this->width != other.width) return this->width < other.width;
+        if (this->height != other.height) return this->height < other.height;
+        if (this->baseTypes != other.baseTypes) return this->baseTypes < other.baseTypes;
+        return this->minimumMoves < other.minimumMoves;
+    }
+};
+
+// settings read from files or sent by clients are checked against these before a game is built on them
+const int MIN_TILE_TYPES = 5; // three plain colours, so generateBoard always has one left for a cell
+const int MAX_TILE_TYPES = (int)Tile::TileType::WILDCARD + 2; // all five plain colours
+
+// each side is bounded before the product, so huge sizes cannot wrap around to a small board
+bool playableSettings(int64_t width, int64_t height, int64_t tileTypes, int64_t wildcardChance, double powerUpBomb, int64_t maxCells)
+{
+    if (width < 3 || height < 3 || width > maxCells || height > maxCells || width * height > maxCells) return false;
+    if (tileTypes < MIN_TILE_TYPES || tileTypes > MAX_TILE_TYPES) return false;
+    return wildcardChance >= 0 && wildcardChance <= 100 && powerUpBomb > 0;
+}
+
+int bitCount(unsigned bits)
+{
+    int count = 0;
+    for (; bits; bits &= bits - 1) count++;
+    return count;
+}
+
+// index of the n-th set bit, counting from the lowest
+int nthSetBit(unsigned bits, int n)
+{
+    for (int i = 0; i < n; i++) bits &= bits - 1;
+    int index = 0;
+    while (!(bits & 1u))
+    {
+        bits >>= 1;
+        index++;
+    }
+    return index;
+}
+
+// sets the three cells of a move to one colour if that lines nothing up, a line can only run through a changed cell
+bool plantMove(Board& board, const int* cells, int baseTypes)
+{
+    int previous[3] = { board.cells[cells[0]], board.cells[cells[1]], board.cells[cells[2]] };
+    for (int type = 0; type < baseTypes; type++)
+    {
+        bool fits = true;
+        for (int k = 0; k < 3; k++) board.cells[cells[k]] = type;
+        for (int k = 0; k < 3 && fits; k++) fits = !lineThrough(board, cells[k] % board.width, cells[k] / board.width);
+        if (fits) return true;
+        for (int k = 0; k < 3; k++) board.cells[cells[k]] = previous[k];
+    }
+    return false;
+}
+
+// no line of three anywhere and at least minimumMoves legal swaps, the same seed always gives the same board
+// each cell picks from a bitmask of the colours that cannot complete a line with its left or upper pair.
+// false only when the board is too small to hold minimumMoves without a line
+bool generateBoard(Board& board, const GeneratorSettings& settings, uint64_t seed)
+{
+    Random random(seed);
+    const unsigned allTypes = (1u << settings.baseTypes) - 1;
+    for (int attempt = 0; attempt < 1000; attempt++)
+    {
+        for (int row = 0; row < board.height; row++)
+        {
+            for (int column = 0; column < board.width; column++)
+            {
+                unsigned allowed = allTypes;
+                if (column >= 2 && board.at(column - 1, row) == board.at(column - 2, row)) allowed &= ~(1u << board.at(column - 1, row));
+                if (row >= 2 && board.at(column, row - 1) == board.at(column, row - 2)) allowed &= ~(1u << board.at(column, row - 1));
+                if (allowed == 0) allowed = allTypes; // only with fewer than three colours
+                board.at(column, row) = nthSetBit(allowed, random.nextInt(bitCount(allowed)));
+            }
+        }
+        if (countLegalMoves(board, settings.minimumMoves) >= settings.minimumMoves) return true;
+    }
+
+    // out of attempts: plant moves into the last board, like dealTiles does, until there are enough
+    for (int cell = 0; cell < board.cells.size(); cell++)
+    {
+        if (countLegalMoves(board, settings.minimumMoves) >= settings.minimumMoves) return true;
+        int column = cell % board.width;
+        int row = cell / board.width;
+        int across[3] = { cell, cell + 1, cell + board.width + 2 };
+        int down[3] = { cell, cell + board.width, cell + 2 * board.width + 1 };
+        bool planted = column + 2 < board.width && row + 1 < board.height && plantMove(board, across, settings.baseTypes);
+        if (!planted && column + 1 < board.width && row + 2 < board.height) plantMove(board, down, settings.baseTypes);
+    }
+    return countLegalMoves(board, settings.minimumMoves) >= settings.minimumMoves;
+}
+
+// keeps a few boards ready per config on a background thread, so a new game or a reset takes a
+// finished board instead of generating one on the frame thread. boards are asked for by seed,
+// and a board taken from here is identical to what generateBoard would build for that seed
+class BoardPregenerator
+{
+public:
+    int depth;
+
+    BoardPregenerator(int depth) :
+        depth{ depth }
+    {
+        this->worker = std::thread([this]() { this->work(); });
+    }
+
+    BoardPregenerator(const BoardPregenerator&) = delete;
+    BoardPregenerator& operator=(const BoardPregenerator&) = delete;
+
+    ~BoardPregenerator()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->wake.notify_all();
+        this->worker.join();
+    }
+
+    void prefetch(const GeneratorSettings& settings, uint64_t seed)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            std::deque<ReadyBoard>& queue = this->queues[settings];
+            for (int i = 0; i < queue.size(); i++)
+            {
+                if (queue[i].seed == seed) return;
+            }
+            ReadyBoard entry;
+            entry.seed = seed;
+            queue.push_back(entry);
+            while (queue.size() > this->depth) queue.pop_front();
+        }
+        this->wake.notify_one();
+    }
+
+    // false when the board for this seed is not finished yet
+    bool take(const GeneratorSettings& settings, uint64_t seed, Board& board)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        std::deque<ReadyBoard>& queue = this->queues[settings];
+        for (int i = 0; i < queue.size(); i++)
+        {
+            if (queue[i].seed != seed || !queue[i].ready) continue;
+            board.cells.swap(queue[i].cells);
+            queue.erase(queue.begin() + i);
+            return true;
+        }
+        return false;
+    }
+
+private:
+    struct ReadyBoard
+    {
+        uint64_t seed{ 0 };
+        bool ready{ false };
+        bool working{ false };
+        std::vector<int> cells;
+    };
+
+    std::map<GeneratorSettings, std::deque<ReadyBoard>> queues;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread worker;
+    bool stopping{ false };
+
+    ReadyBoard* findWork(const GeneratorSettings*& settings)
+    {
+        for (std::map<GeneratorSettings, std::deque<ReadyBoard>>::iterator it = this->queues.begin(); it != this->queues.end(); ++it)
+        {
+            for (int i = 0; i < it->second.size(); i++)
+            {
+                if (it->second[i].ready || it->second[i].working) continue;
+                settings = &it->first;
+                return &it->second[i];
+            }
+        }
+        return nullptr;
+    }
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while (true)
+        {
+            const GeneratorSettings* settings = nullptr;
+            this->wake.wait(lock, [this, &settings]() { return this->stopping || this->findWork(settings) != nullptr; });
+            if (this->stopping) return;
+
+            ReadyBoard* entry = this->findWork(settings);
+            entry->working = true;
+            GeneratorSettings wanted = *settings;
+            uint64_t seed = entry->seed;
+
+            lock.unlock();
+            Board board(wanted.width, wanted.height);
+            if (!generateBoard(board, wanted, seed)) LOG(Warning, Logic, "A {}x{} board cannot hold {} legal moves", wanted.width, wanted.height, wanted.minimumMoves);
+            lock.lock();
+
+            // the entry may have been taken or pushed out of the queue in the meantime
+            std::deque<ReadyBoard>& queue = this->queues[wanted];
+            for (int i = 0; i < queue.size(); i++)
+            {
+                if (queue[i].seed != seed || queue[i].ready) continue;
+                queue[i].cells.swap(board.cells);
+                queue[i].ready = true;
+                queue[i].working = false;
+                break;
+            }
+        }
+    }
+};
+
+// ==========
+// Kernel benchmark
+// ==========
+
+// a 5-line with a 3-line standing on its middle tile holds both a T and a 5-line, and the 5-line ranks
+// first whichever way the pair faces. true when it alone is found, above and upside down
+bool checkShapePriority()
+{
+    const int red = (int)Tile::TileType::RED;
+    std::vector<uint64_t> masks;
+    std::vector<TileUpgrade> upgrades;
+    bool right = true;
+    for (int flip = 0; flip < 2; flip++)
+    {
+        Board board(8, 8);
+        std::fill(board.cells.begin(), board.cells.end(), (int)Tile::TileType::BLUE);
+        std::vector<char> kill(board.cells.size(), 0);
+        int stemRow = flip ? 3 : 0; // the line is on row 2
+        board.cells[board.index(2, stemRow)] = red;
+        board.cells[board.index(2, stemRow + 1)] = red;
+        for (int column = 0; column < 5; column++) board.cells[board.index(column, 2)] = red;
+        for (int i = 0; i < board.cells.size(); i++) kill[i] = board.cells[i] == red;
+
+        upgrades.clear();
+        standardRules().findShapes(board, kill, -1, -1, masks, upgrades);
+        right = right && upgrades.size() == 1 && upgrades[0].type == (int)Tile::TileType::COLOUR_CLEAR;
+    }
+    return right;
+}
+
+// times the fixed size kernels against the generic scans on the same random boards, and checks they agree
+int benchmarkKernels()
+{
+    const int samples = 256;
+    const int rounds = 200;
+    Random random(1);
+    bool agree = true;
+    std::vector<char> kill, genericKill;
+    std::vector<SwapMove> moves, genericMoves;
+
+    for (int size = 7; size <= 10; size++)
+    {
+        std::vector<Board> boards(samples, Board(size, size));
+        for (int b = 0; b < samples; b++)
+        {
+            for (int i = 0; i < boards[b].cells.size(); i++)
+            {
+                boards[b].cells[i] = random.nextInt(20) == 0 ? random.nextInt(TILE_TYPES) : random.nextInt(5);
+            }
+        }
+
+        const BoardKernels* fixed = boards[0].kernels;
+        for (int b = 0; b < samples; b++)
+        {
+            bool same = fixed->findMatches(boards[b], kill) == findMatchesGeneric(boards[b], genericKill) && kill == genericKill;
+            fixed->legalMoves(boards[b], moves);
+            legalMovesGeneric(boards[b], genericMoves);
+            same = same && moves.size() == genericMoves.size();
+            for (int m = 0; same && m < moves.size(); m++) same = moves[m].from == genericMoves[m].from && moves[m].to == genericMoves[m].to;
+            if (!same) agree = false;
+        }
+
+        int checksum = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++) for (int b = 0; b < samples; b++) checksum += findMatchesGeneric(boards[b], kill);
+        double genericMatches = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++) for (int b = 0; b < samples; b++) checksum -= fixed->findMatches(boards[b], kill);
+        double fixedMatches = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++) for (int b = 0; b < samples; b++) checksum += countLegalMovesGeneric(boards[b], 1000);
+        double genericMoveCount = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++) for (int b = 0; b < samples; b++) checksum -= fixed->countLegalMoves(boards[b], 1000);
+        double fixedMoveCount = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (checksum != 0) agree = false;
+
+        double perBoard = 1e9 / (rounds * samples);
+        std::cout << size << "x" << size << ": matches " << genericMatches * perBoard << " ns -> " << fixedMatches * perBoard << " ns ("
+            << genericMatches / fixedMatches << "x), legal moves " << genericMoveCount * perBoard << " ns -> " << fixedMoveCount * perBoard << " ns ("
+            << genericMoveCount / fixedMoveCount << "x)" << std::endl;
+    }
+
+    std::cout << (agree ? "Fixed kernels agree with the generic scans" : "Fixed kernels DISAGREE with the generic scans") << std::endl;
+    return agree ? 0 : 1;
+}
+
+// ==========
+// Reshuffle
+// ==========
+
+bool fitsWithoutLine(Board& board, int cell, int type)
+{
+    int previous = board.cells[cell];
+    board.cells[cell] = type;
+    bool fits = !lineThrough(board, cell % board.width, cell / board.width);
+    board.cells[cell] = previous;
+    return fits;
+}
+
+// deals the tiles counted in counts onto an empty board, see shuffleBoard
+bool dealTiles(Board& result, int* counts, ArenaVector<char>& planted, Random& random)
+{
+    const int types = TILE_TYPES;
+    const int wildcard = (int)Tile::TileType::WILDCARD;
+
+    int plantedType = -1;
+    for (int t = 0; t < types; t++)
+    {
+        if (t != wildcard && (plantedType < 0 || counts[t] > counts[plantedType])) plantedType = t;
+    }
+    int plantedCells[3] = { result.index(0, 0), result.index(1, 0), result.index(2, 1) };
+    for (int k = 0; k < 3; k++)
+    {
+        int type = counts[plantedType] > 0 ? plantedType : wildcard;
+        if (counts[type] == 0) return false;
+        counts[type]--;
+        result.cells[plantedCells[k]] = type;
+        planted[plantedCells[k]] = 1;
+    }
+
+    for (int cell = 0; cell < result.cells.size(); cell++)
+    {
+        if (planted[cell]) continue;
+
+        int best = -1;
+        for (int t = 0; t < types; t++)
+        {
+            if (counts[t] == 0 || !fitsWithoutLine(result, cell, t)) continue;
+            if (best < 0 || counts[t] > counts[best] || (counts[t] == counts[best] && random.nextInt(2) == 0)) best = t;
+        }
+
+        if (best >= 0)
+        {
+            result.cells[cell] = best;
+            counts[best]--;
+            continue;
+        }
+
+        // stuck: hand an earlier cell's tile to this one and give the earlier cell something still left
+        bool repaired = false;
+        for (int earlier = 0; earlier < cell && !repaired; earlier++)
+        {
+            if (planted[earlier]) continue;
+            int moved = result.cells[earlier];
+            for (int t = 0; t < types && !repaired; t++)
+            {
+                if (counts[t] == 0) continue;
+                result.cells[earlier] = t;
+                result.cells[cell] = moved;
+                if (!lineThrough(result, earlier % result.width, earlier / result.width) && !lineThrough(result, cell % result.width, cell / result.width))
+                {
+                    counts[t]--;
+                    repaired = true;
+                }
+                else
+                {
+                    result.cells[earlier] = moved;
+                    result.cells[cell] = Board::EMPTY;
+                }
+            }
+        }
+        if (!repaired) return false;
+    }
+
+    for (int cell = 0; cell < result.cells.size(); cell++)
+    {
+        if (lineThrough(result, cell % result.width, cell / result.width)) return false;
+    }
+    return matchPossible(result);
+}
+
+// rearranges the tiles already on a full board so there is no line and at least one legal move.
+// a move is planted first (two of a kind in the top row, a third one diagonally below the gap),
+// then every other cell takes the most plentiful tile that does not complete a line, and a cell
+// that fits nothing trades with an earlier one. every step is bounded, nothing retries at random.
+// false when the tile mix cannot do it, e.g. almost the whole board is one colour, and the board is
+// left as it was. the board is dealt in place, the scratch buffers come from the frame arena
+bool shuffleBoard(Board& board, Random& random)
+{
+    const int types = TILE_TYPES;
+    if (board.width < 3 || board.height < 2) return false;
+
+    int counts[types] = { 0 };
+    for (int i = 0; i < board.cells.size(); i++)
+    {
+        if (board.cells[i] == Board::EMPTY) return false;
+        counts[board.cells[i]]++;
+    }
+
+    ArenaScope scope(frameArena);
+    ArenaVector<int> original(board.cells.begin(), board.cells.end(), ArenaAllocator<int>(frameArena));
+    ArenaVector<char> planted(board.cells.size(), 0, ArenaAllocator<char>(frameArena));
+    std::fill(board.cells.begin(), board.cells.end(), (int)Board::EMPTY);
+    if (dealTiles(board, counts, planted, random)) return true;
+    std::copy(original.begin(), original.end(), board.cells.begin());
+    return false;
+}
+
+// ==========
+// Resolution
+// ==========
+
+// visible outcome of one logic step, the renderer turns it into animations
+struct CascadeStep
+{
+    enum Kind
+    {
+        SWAP,
+        COLLAPSE,
+        SETTLE
+    };
+
+    Kind kind{ SWAP };
+    std::vector<int> cleared; // cell indices emptied by this step
+    std::vector<TileMove> moves;
+    std::vector<TileSpawn> spawns;
+    std::vector<TileShuffle> shuffles;
+    std::vector<TileUpgrade> upgrades; // specials left on cleared cells by matched shapes
+    int scoreGained{ 0 };
+    bool accepted{ true }; // false when a swap made no match and was undone
+    bool detonated{ false }; // a swapped special went off
+    bool reshuffled{ false }; // deadlocked board rearranged in place, see shuffles
+    bool reset{ false }; // deadlocked board replaced without scoring
+
+    void clear()
+    {
+        this->cleared.clear();
+        this->moves.clear();
+        this->spawns.clear();
+        this->shuffles.clear();
+        this->upgrades.clear();
+        this->scoreGained = 0;
+        this->accepted = true;
+        this->detonated = false;
+        this->reshuffled = false;
+        this->reset = false;
+    }
+
+    // no step touches a cell twice, so buffers this size never grow
+    void reserve(int cells)
+    {
+        this->cleared.reserve(cells);
+        this->moves.reserve(cells);
+        this->spawns.reserve(cells);
+        this->shuffles.reserve(cells);
+        this->upgrades.reserve(cells);
+    }
+};
+
+// ordered steps of one full resolution, reused between calls so the step buffers keep their capacity
+class CascadeLog
+{
+public:
+    std::vector<CascadeStep> steps;
+    int count{ 0 };
+
+    void clear()
+    {
+        this->count = 0;
+    }
+
+    static const int DEPTH = 64; // the deepest cascade in 200k turns on 7x7 boards had 27 steps
+
+    // steps made ahead of time for the game on screen; the many logs of headless hosts grow as they go
+    void reserve(int depth, int cells)
+    {
+        while (this->steps.size() < depth)
+        {
+            this->steps.push_back(CascadeStep());
+            this->steps.back().reserve(cells);
+        }
+    }
+
+    // a new step is sized for the whole board, so a turn only allocates when its cascade runs deeper than any before
+    CascadeStep& add(int cells)
+    {
+        if (this->count == this->steps.size())
+        {
+            this->steps.push_back(CascadeStep());
+            this->steps.back().reserve(cells);
+        }
+        CascadeStep& step = this->steps[this->count++];
+        step.clear();
+        return step;
+    }
+
+    int size() const
+    {
+        return this->count;
+    }
+
+    CascadeStep& operator[](int i)
+    {
+        return this->steps[i];
+    }
+
+    const CascadeStep& operator[](int i) const
+    {
+        return this->steps[i];
+    }
+
+    int scoreGained() const
+    {
+        int total = 0;
+        for (int i = 0; i < this->count; i++) total += this->steps[i].scoreGained;
+        return total;
+    }
+};
+const int CascadeLog::DEPTH;
+
+// the whole rule set on integer cells, no SFML - main() drives it and animates the results,
+// replays and other headless tools drive it directly
+//
+// swap() resolves the swapped tiles at once, collapse() drops tiles into the holes and
+// settle() resolves whatever the collapse lined up. a pending settle is always flushed
+// before the next swap or collapse, so the order of those calls alone fixes the outcome
+class GameLogic
+{
+public:
+    Board board;
+    SpawnGenerator spawner;
+    GravityEngine gravity;
+    int score{ 0 };
+    int powerUpTracker{ 0 };
+    bool collapseNeeded{ false };
+    bool settlePending{ false };
+
+    Random layouts;
+    GeneratorSettings generatorSettings;
+    BoardPregenerator* pregenerator; // optional, copies made for simulations should clear it
+    const RuleSet* rules;
+    Telemetry* telemetry{ nullptr }; // only the game on screen reports, simulations leave it unset
+
+    GameLogic(Config& config, uint64_t seed, BoardPregenerator* pregenerator = nullptr) :
+        board((int)config.gridWidth, (int)config.gridHeight),
+        spawner(config, Random::forStream(seed, STREAM_BOARD)),
+        gravity(config),
+        layouts(Random::forStream(seed, STREAM_LAYOUTS)),
+        generatorSettings(config),
+        pregenerator{ pregenerator },
+        rules{ &standardRules() }
+    {
+        this->nextLayout();
+    }
+
+    bool canSwap(int from, int to) const
+    {
+        int size = this->board.cells.size();
+        if (from < 0 || to < 0 || from >= size || to >= size) return false;
+        if (this->board.cells[from] == Board::EMPTY || this->board.cells[to] == Board::EMPTY) return false;
+        int dx = std::abs(from % this->board.width - to % this->board.width);
+        int dy = std::abs(from / this->board.width - to / this->board.width);
+        return dx + dy == 1;
+    }
+
+    bool swap(int from, int to, CascadeStep& step)
+    {
+        this->flush();
+        step.kind = CascadeStep::SWAP;
+        step.accepted = false;
+        if (!this->canSwap(from, to)) return false;
+
+        std::swap(this->board.cells[from], this->board.cells[to]);
+        int moved = this->board.cells[to];
+        int other = this->board.cells[from];
+        if (this->rules->isSpecial(moved) || this->rules->isSpecial(other))
+        {
+            // swapped specials go off where they landed, a colour clear takes the colour it was swapped with
+            this->kill.assign(this->board.cells.size(), 0);
+            if (this->rules->isSpecial(moved)) this->kill[to] = 1;
+            if (this->rules->isSpecial(other)) this->kill[from] = 1;
+            step.detonated = true;
+            if (this->telemetry) this->telemetry->specialsSetOff++;
+            this->clearCells(this->kill, step, this->rules->isSpecial(moved) ? other : moved);
+        }
+        else
+        {
+            // the board was settled, so any new line runs through one of the swapped cells
+            int width = this->board.width;
+            if (!lineThrough(this->board, to % width, to / width) && !lineThrough(this->board, from % width, from / width))
+            {
+                std::swap(this->board.cells[from], this->board.cells[to]);
+                return false;
+            }
+            this->clearMatches(step, to, from);
+            if (step.cleared.empty())
+            {
+                std::swap(this->board.cells[from], this->board.cells[to]);
+                return false;
+            }
+        }
+        step.accepted = true;
+        this->cascadeDepth = 1;
+        if (this->telemetry) this->telemetry->swaps++;
+        return true;
+    }
+
+    void collapse(CascadeStep& step)
+    {
+        this->flush();
+        step.kind = CascadeStep::COLLAPSE;
+        if (!this->collapseNeeded) return;
+        this->collapseNeeded = false;
+        this->gravity.collapse(this->board, this->spawner, this->powerUpTracker, step.moves, step.spawns);
+        this->settlePending = true;
+    }
+
+    // returns true when there was something to settle
+    bool settle(CascadeStep& step)
+    {
+        if (!this->settlePending) return false;
+        this->settlePending = false;
+        step.kind = CascadeStep::SETTLE;
+        this->clearMatches(step);
+        if (!step.cleared.empty()) this->cascadeDepth++;
+        else if (this->telemetry && this->cascadeDepth > 0)
+        {
+            this->telemetry->cascades++;
+            this->telemetry->cascadeDepth.add(this->cascadeDepth - 1);
+            this->cascadeDepth = 0;
+        }
+        if (step.cleared.empty() && !matchPossible(this->board) && !this->reshuffle(step))
+        {
+            this->reset(step);
+        }
+        if (this->telemetry && step.reshuffled) this->telemetry->reshuffles++;
+        if (this->telemetry && step.reset) this->telemetry->newBoards++;
+        return true;
+    }
+
+    // the swap resolved to a fixed point in one call: match or bomb, then collapse and
+    // settle until the board is stable, with every step appended to the log in order
+    bool resolveSwap(int from, int to, CascadeLog& log)
+    {
+        if (!this->swap(from, to, log.add(this->board.cells.size()))) return false;
+        this->resolve(log);
+        return true;
+    }
+
+    // runs whatever collapses and cascades are still pending
+    void resolve(CascadeLog& log)
+    {
+        while (this->collapseNeeded || this->settlePending)
+        {
+            if (this->settlePending) this->settle(log.add(this->board.cells.size()));
+            else this->collapse(log.add(this->board.cells.size()));
+        }
+    }
+
+private:
+    // scratch, kept around so resolving does not allocate
+    std::vector<char> kill;
+    std::vector<uint64_t> shapeMasks;
+    std::vector<int> chain;
+    int cascadeDepth{ 0 };
+
+    void flush()
+    {
+        if (!this->settlePending) return;
+        CascadeStep step;
+        this->settle(step);
+    }
+
+    // chained specials first, then the cells go and the shape specials take their places
+    void clearCells(std::vector<char>& kill, CascadeStep& step, int colourHint)
+    {
+        for (int i = 0; i < kill.size(); i++)
+        {
+            if (kill[i]) step.cleared.push_back(i);
+        }
+        this->rules->activate(this->board, kill, step.cleared, colourHint, this->chain);
+        for (int c = 0; c < step.cleared.size(); c++)
+        {
+            this->board.cells[step.cleared[c]] = Board::EMPTY;
+        }
+        for (int u = 0; u < step.upgrades.size(); u++)
+        {
+            this->board.cells[step.upgrades[u].cell] = step.upgrades[u].type;
+        }
+        if (step.cleared.empty()) return;
+        if (this->telemetry)
+        {
+            this->telemetry->tilesMatched += step.cleared.size();
+            this->telemetry->specialsCreated += step.upgrades.size();
+        }
+        step.scoreGained = scoreForClearedTiles(step.cleared.size());
+        this->score += step.scoreGained;
+        this->collapseNeeded = true;
+    }
+
+    // swapped cells are where a matched shape prefers to leave its special
+    void clearMatches(CascadeStep& step, int preferred = -1, int alsoPreferred = -1)
+    {
+        int lines;
+        if (this->telemetry)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            lines = findMatches(this->board, this->kill);
+            this->telemetry->matchScanNanos.add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        }
+        else lines = findMatches(this->board, this->kill);
+        if (lines == 0) return;
+        this->powerUpTracker += lines;
+        // every shape spans at least two lines
+        if (lines >= 2) this->rules->findShapes(this->board, this->kill, preferred, alsoPreferred, this->shapeMasks, step.upgrades);
+        this->clearCells(this->kill, step, -1);
+    }
+
+    // replaces the board with the next generated layout, taken from the pregenerator when it is ready
+    void nextLayout()
+    {
+        uint64_t seed = this->layouts.next();
+        if (!this->pregenerator || !this->pregenerator->take(this->generatorSettings, seed, this->board))
+        {
+            const GeneratorSettings& settings = this->generatorSettings;
+            if (!generateBoard(this->board, settings, seed)) LOG(Warning, Logic, "A {}x{} board cannot hold {} legal moves", settings.width, settings.height, settings.minimumMoves);
+        }
+
+        if (this->pregenerator)
+        {
+            Random upcoming = this->layouts;
+            for (int i = 0; i < this->pregenerator->depth; i++) this->pregenerator->prefetch(this->generatorSettings, upcoming.next());
+        }
+    }
+
+    // no move left: the same tiles are rearranged so one appears, every tile keeps its identity
+    bool reshuffle(CascadeStep& step)
+    {
+        ArenaScope scope(frameArena);
+        ArenaVector<int> before(this->board.cells.begin(), this->board.cells.end(), ArenaAllocator<int>(frameArena));
+        if (!shuffleBoard(this->board, this->spawner.random)) return false;
+
+        // hand out the old cells of each type in order, so every tile has exactly one destination
+        const int types = TILE_TYPES;
+        int next[types + 1] = { 0 };
+        for (int i = 0; i < before.size(); i++) next[before[i] + 1]++;
+        for (int t = 0; t < types; t++) next[t + 1] += next[t];
+        ArenaVector<int> oldCells(before.size(), 0, ArenaAllocator<int>(frameArena));
+        for (int i = 0; i < before.size(); i++) oldCells[next[before[i]]++] = i;
+        for (int t = types; t > 0; t--) next[t] = next[t - 1];
+        next[0] = 0;
+
+        step.reshuffled = true;
+        for (int i = 0; i < this->board.cells.size(); i++)
+        {
+            int from = oldCells[next[this->board.cells[i]]++];
+            if (from != i) step.shuffles.push_back({ from, i });
+        }
+        return true;
+    }
+
+    // the tile mix cannot be rearranged: the whole board drops out for a fresh generated one, nothing is scored
+    void reset(CascadeStep& step)
+    {
+        step.reset = true;
+        for (int i = 0; i < this->board.cells.size(); i++)
+        {
+            if (this->board.cells[i] != Board::EMPTY) step.cleared.push_back(i);
+        }
+
+        this->nextLayout();
+        for (int row = 0; row < this->board.height; row++)
+        {
+            for (int column = 0; column < this->board.width; column++)
+            {
+                step.spawns.push_back({ column, row, row - this->board.height, this->board.at(column, row) });
+            }
+        }
+        this->collapseNeeded = false;
+        this->settlePending = false;
+    }
+};
+
+//====================================================================================
+//                           .: REPLAYS :.
+//====================================================================================
+
+enum ReplayOp
+{
+    REPLAY_SWAP_RIGHT = 0,
+    REPLAY_SWAP_DOWN = 1,
+    REPLAY_SWAP_LEFT = 2,
+    REPLAY_SWAP_UP = 3,
+    REPLAY_COLLAPSE = 4,
+    REPLAY_SETTLE = 5
+};
+
+struct ReplayCommand
+{
+    uint32_t timeMs;
+    int op;
+    int cell;
+};
+
+void writeVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+bool readVarint(const uint8_t*& data, const uint8_t* end, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && data < end; shift += 7)
+    {
+        uint8_t byte = *data++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// seed, gameplay config and the command stream of one game
+//
+// file layout: "M3RP", version byte, varint seed, varint config fields, zigzag final score,
+// varint command count, then per command varint((deltaMs << 3) | op) plus varint(cell) for swaps
+class Replay
+{
+public:
+    static const uint8_t VERSION = 4;
+    static const int MAX_CELLS = 1 << 16; // 256x256, larger than any board the game is played on
+
+    uint64_t seed{ 0 };
+    int gridWidth{ 7 };
+    int gridHeight{ 7 };
+    int tileTypes{ 7 };
+    int wildcardChance{ 5 };
+    int powerUpBomb{ 10 };
+    int finalScore{ 0 };
+    std::vector<ReplayCommand> commands;
+
+    void captureConfig(Config& config)
+    {
+        this->gridWidth = (int)config.gridWidth;
+        this->gridHeight = (int)config.gridHeight;
+        this->tileTypes = config.tileTypes;
+        this->wildcardChance = config.wildcardChance;
+        this->powerUpBomb = (int)config.powerUpBomb;
+    }
+
+    Config makeConfig() const
+    {
+        Config c;
+        c.gridWidth = (float)this->gridWidth;
+        c.gridHeight = (float)this->gridHeight;
+        c.tileTypes = this->tileTypes;
+        c.wildcardChance = this->wildcardChance;
+        c.powerUpBomb = (float)this->powerUpBomb;
+        c.seed = this->seed;
+        return c;
+    }
+
+    void encode(std::vector<uint8_t>& out) const
+    {
+        const char magic[] = { 'M', '3', 'R', 'P' };
+        out.insert(out.end(), magic, magic + 4);
+        out.push_back(VERSION);
+        writeVarint(out, this->seed);
+        writeVarint(out, this->gridWidth);
+        writeVarint(out, this->gridHeight);
+        writeVarint(out, this->tileTypes);
+        writeVarint(out, this->wildcardChance);
+        writeVarint(out, this->powerUpBomb);
+        writeVarint(out, ((uint64_t)this->finalScore << 1) ^ (uint64_t)(int64_t)(this->finalScore >> 31));
+        writeVarint(out, this->commands.size());
+
+        uint32_t lastTime = 0;
+        for (int i = 0; i < this->commands.size(); i++)
+        {
+            const ReplayCommand& command = this->commands[i];
+            writeVarint(out, ((uint64_t)(command.timeMs - lastTime) << 3) | command.op);
+            if (command.op <= REPLAY_SWAP_UP) writeVarint(out, command.cell);
+            lastTime = command.timeMs;
+        }
+    }
+
+    bool decode(const uint8_t* data, size_t size)
+    {
+        const uint8_t* end = data + size;
+        if (size < 5 || data[0] != 'M' || data[1] != '3' || data[2] != 'R' || data[3] != 'P' || data[4] != VERSION) return false;
+        data += 5;
+
+        uint64_t fields[8];
+        for (int i = 0; i < 8; i++)
+        {
+            if (!readVarint(data, end, fields[i])) return false;
+        }
+        // replays come from players, a made up header must not get as far as building a game
+        if (!playableSettings((int64_t)fields[1], (int64_t)fields[2], (int64_t)fields[3], (int64_t)fields[4], (int64_t)fields[5], MAX_CELLS)) return false;
+        this->seed = fields[0];
+        this->gridWidth = (int)fields[1];
+        this->gridHeight = (int)fields[2];
+        this->tileTypes = (int)fields[3];
+        this->wildcardChance = (int)fields[4];
+        this->powerUpBomb = (int)fields[5];
+        this->finalScore = (int)(fields[6] >> 1) ^ -(int)(fields[6] & 1);
+
+        this->commands.clear();
+        this->commands.reserve((size_t)std::min<uint64_t>(fields[7], end - data)); // a command takes at least a byte
+        uint32_t time = 0;
+        for (uint64_t i = 0; i < fields[7]; i++)
+        {
+            uint64_t head, cell = 0;
+            if (!readVarint(data, end, head)) return false;
+            ReplayCommand command;
+            command.op = head & 7;
+            time += (uint32_t)(head >> 3);
+            command.timeMs = time;
+            if (command.op <= REPLAY_SWAP_UP && !readVarint(data, end, cell)) return false;
+            command.cell = (int)cell;
+            this->commands.push_back(command);
+        }
+        return true;
+    }
+
+    bool save(const std::string& path) const
+    {
+        std::vector<uint8_t> bytes;
+        this->encode(bytes);
+        std::ofstream file(path, std::ios::binary);
+        file.write((const char*)bytes.data(), bytes.size());
+        return file.good();
+    }
+
+    bool load(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return file.is_open() && this->decode(bytes.data(), bytes.size());
+    }
+};
+const uint8_t Replay::VERSION;
+const int Replay::MAX_CELLS;
+
+// sits next to the GameLogic driven by main() and notes down every call that changed it
+class ReplayRecorder
+{
+public:
+    Replay replay;
+    std::chrono::steady_clock::time_point start;
+
+    ReplayRecorder(Config& config)
+    {
+        this->replay.seed = config.seed;
+        this->replay.captureConfig(config);
+        this->start = std::chrono::steady_clock::now();
+    }
+
+    void swap(int width, int from, int to)
+    {
+        int op = REPLAY_SWAP_RIGHT;
+        if (to == from + width) op = REPLAY_SWAP_DOWN;
+        else if (to == from - 1) op = REPLAY_SWAP_LEFT;
+        else if (to == from - width) op = REPLAY_SWAP_UP;
+        this->add(op, from);
+    }
+
+    void collapse()
+    {
+        this->add(REPLAY_COLLAPSE, 0);
+    }
+
+    void settle()
+    {
+        this->add(REPLAY_SETTLE, 0);
+    }
+
+    // everything a GameLogic::resolveSwap or resolve call did, from and to only matter for a swap step
+    void cascade(const CascadeLog& log, int width, int from, int to)
+    {
+        for (int i = 0; i < log.size(); i++)
+        {
+            if (log[i].kind == CascadeStep::SWAP) this->swap(width, from, to);
+            else if (log[i].kind == CascadeStep::COLLAPSE) this->collapse();
+            else this->settle();
+        }
+    }
+
+    bool save(const std::string& path, int finalScore)
+    {
+        this->replay.finalScore = finalScore;
+        return this->replay.save(path);
+    }
+
+private:
+    void add(int op, int cell)
+    {
+        ReplayCommand command;
+        command.timeMs = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - this->start).count();
+        command.op = op;
+        command.cell = cell;
+        this->replay.commands.push_back(command);
+    }
+};
+
+// re-simulates a replay through GameLogic as fast as it will go, no window or audio
+class ReplayPlayer
+{
+public:
+    Replay replay;
+    Config config;
+    GameLogic logic;
+    int position{ 0 };
+    int snapshotInterval;
+    std::vector<GameLogic> snapshots; // snapshots[k] is the state before command k * snapshotInterval
+
+    ReplayPlayer(const Replay& replay, int snapshotInterval = 64) :
+        replay{ replay },
+        config{ replay.makeConfig() },
+        logic(config, replay.seed),
+        snapshotInterval{ snapshotInterval }
+    {
+        this->snapshots.push_back(this->logic);
+    }
+
+    bool finished() const
+    {
+        return this->position >= this->replay.commands.size();
+    }
+
+    void step()
+    {
+        const ReplayCommand& command = this->replay.commands[this->position++];
+        int width = this->logic.board.width;
+        this->scratch.clear();
+        switch (command.op)
+        {
+        case REPLAY_SWAP_RIGHT:
+            this->logic.swap(command.cell, command.cell + 1, this->scratch);
+            break;
+        case REPLAY_SWAP_DOWN:
+            this->logic.swap(command.cell, command.cell + width, this->scratch);
+            break;
+        case REPLAY_SWAP_LEFT:
+            this->logic.swap(command.cell, command.cell - 1, this->scratch);
+            break;
+        case REPLAY_SWAP_UP:
+            this->logic.swap(command.cell, command.cell - width, this->scratch);
+            break;
+        case REPLAY_COLLAPSE:
+            this->logic.collapse(this->scratch);
+            break;
+        case REPLAY_SETTLE:
+            this->logic.settle(this->scratch);
+            break;
+        default:
+            ;
+        }
+
+        if (this->snapshotInterval > 0 && this->position % this->snapshotInterval == 0 && this->snapshots.size() == this->position / this->snapshotInterval)
+        {
+            this->snapshots.push_back(this->logic);
+        }
+    }
+
+    // jumps to the state right before the given command, from the closest snapshot at or before it
+    void seek(int command)
+    {
+        command = std::max(0, std::min(command, (int)this->replay.commands.size()));
+        int snapshot = 0;
+        if (this->snapshotInterval > 0) snapshot = std::min(command / this->snapshotInterval, (int)this->snapshots.size() - 1);
+        int snapshotPosition = snapshot * this->snapshotInterval;
+        if (this->position > command || snapshotPosition > this->position)
+        {
+            this->logic = this->snapshots[snapshot];
+            this->position = snapshotPosition;
+        }
+        while (this->position < command) this->step();
+    }
+
+    bool verify()
+    {
+        this->seek(0);
+        while (!this->finished()) this->step();
+        return this->logic.score == this->replay.finalScore;
+    }
+
+private:
+    CascadeStep scratch;
+};
+
+int verifyReplays(int count, char** paths)
+{
+    std::vector<Replay> replays(count);
+    for (int i = 0; i < count; i++)
+    {
+        if (!replays[i].load(paths[i]))
+        {
+            std::cout << "Could not read replay " << paths[i] << std::endl;
+            return 2;
+        }
+    }
+
+    int mismatches = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++)
+    {
+        ReplayPlayer player(replays[i], 0);
+        if (!player.verify())
+        {
+            mismatches++;
+            std::cout << "MISMATCH " << paths[i] << ": claimed " << replays[i].finalScore << ", replayed " << player.logic.score << std::endl;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Verified " << count << " replays, " << mismatches << " mismatches, " << (seconds > 0 ? count / seconds : 0) << " replays/s" << std::endl;
+    return mismatches > 0 ? 1 : 0;
+}
+
+//====================================================================================
+//                           .: SNAPSHOTS :.
+//====================================================================================
+
+// a file mapped into memory, read-only or shared read-write
+// writes to a shared mapping land in the page cache, so they outlive a crashed process
+class MappedFile
+{
+public:
+    void* data{ nullptr };
+    size_t size{ 0 };
+
+    MappedFile()
+    {
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+        this->close();
+    }
+
+    // size 0 maps an existing file whole, otherwise the file is created or resized to fit
+    bool open(const std::string& path, size_t size, bool writable)
+    {
+        this->close();
+#ifdef _WIN32
+        this->file = CreateFileA(path.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (this->file == INVALID_HANDLE_VALUE) return false;
+        if (size == 0)
+        {
+            LARGE_INTEGER fileSize;
+            if (!GetFileSizeEx(this->file, &fileSize) || fileSize.QuadPart == 0)
+            {
+                this->close();
+                return false;
+            }
+            size = (size_t)fileSize.QuadPart;
+        }
+        this->mapping = CreateFileMappingA(this->file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, (DWORD)((uint64_t)size >> 32), (DWORD)size, nullptr);
+        if (this->mapping == nullptr)
+        {
+            this->close();
+            return false;
+        }
+        this->data = MapViewOfFile(this->mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+#else
+        this->fd = ::open(path.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+        if (this->fd < 0) return false;
+        struct stat info;
+        if (fstat(this->fd, &info) != 0)
+        {
+            this->close();
+            return false;
+        }
+        if (size == 0) size = (size_t)info.st_size;
+        if (size == 0 || (writable && (size_t)info.st_size != size && ftruncate(this->fd, size) != 0))
+        {
+            this->close();
+            return false;
+        }
+        this->data = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, this->fd, 0);
+        if (this->data == MAP_FAILED) this->data = nullptr;
+#endif
+        if (this->data == nullptr)
+        {
+            this->close();
+            return false;
+        }
+        this->size = size;
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (this->data) UnmapViewOfFile(this->data);
+        if (this->mapping) CloseHandle(this->mapping);
+        if (this->file != INVALID_HANDLE_VALUE) CloseHandle(this->file);
+        this->mapping = nullptr;
+        this->file = INVALID_HANDLE_VALUE;
+#else
+        if (this->data) munmap(this->data, this->size);
+        if (this->fd >= 0) ::close(this->fd);
+        this->fd = -1;
+#endif
+        this->data = nullptr;
+        this->size = 0;
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE file{ INVALID_HANDLE_VALUE };
+    HANDLE mapping{ nullptr };
+#else
+    int fd{ -1 };
+#endif
+};
+
+// the whole game state in one fixed-layout, trivially copyable block
+// the bytes in memory are the bytes on disk, so a mapped file is used as-is without parsing
+struct GameSnapshot
+{
+    static const uint32_t MAGIC = 0x4e53334d; // "M3SN"
+    static const uint32_t VERSION = 2;
+    static const int MAX_CELLS = 4096;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size; // sizeof(GameSnapshot), catches layout drift between builds
+
+    // gameplay config
+    int32_t gridWidth;
+    int32_t gridHeight;
+    int32_t tileTypes;
+    int32_t wildcardChance;
+    float powerUpBomb;
+    uint64_t seed;
+
+    // logic
+    uint64_t boardRandom[4];
+    uint64_t layoutRandom[4];
+    int32_t logicScore;
+    int32_t powerUpTracker;
+    uint8_t collapseNeeded;
+    uint8_t settlePending;
+    uint8_t padding[2];
+    float createdTiles;
+    float createdWildcardTiles;
+
+    // frame loop
+    uint64_t effectsRandom[4];
+    int32_t score; // Scoreboard::score
+    float coyoteTime;
+
+    int8_t cells[MAX_CELLS];
+
+    // the move validator gets snapshots from clients, so everything a game is built from is checked
+    bool valid() const
+    {
+        if (this->magic != MAGIC || this->version != VERSION || this->size != sizeof(GameSnapshot)) return false;
+        if (!playableSettings(this->gridWidth, this->gridHeight, this->tileTypes, this->wildcardChance, this->powerUpBomb, MAX_CELLS)) return false;
+        for (int i = 0; i < this->gridWidth * this->gridHeight; i++)
+        {
+            if (this->cells[i] < Board::EMPTY || this->cells[i] >= TILE_TYPES) return false;
+        }
+        return true;
+    }
+
+    // magic goes in last, a snapshot torn by a crash mid-write simply reads as invalid
+    bool capture(const GameLogic& logic, Config& config, int score, float coyoteTime, const Random& effects)
+    {
+        if (logic.board.cells.size() > MAX_CELLS) return false;
+        this->magic = 0;
+
+        this->version = VERSION;
+        this->size = sizeof(GameSnapshot);
+        this->gridWidth = logic.board.width;
+        this->gridHeight = logic.board.height;
+        this->tileTypes = config.tileTypes;
+        this->wildcardChance = config.wildcardChance;
+        this->powerUpBomb = config.powerUpBomb;
+        this->seed = config.seed;
+
+        std::memcpy(this->boardRandom, logic.spawner.random.state, sizeof(this->boardRandom));
+        std::memcpy(this->layoutRandom, logic.layouts.state, sizeof(this->layoutRandom));
+        this->logicScore = logic.score;
+        this->powerUpTracker = logic.powerUpTracker;
+        this->collapseNeeded = logic.collapseNeeded;
+        this->settlePending = logic.settlePending;
+        this->padding[0] = this->padding[1] = 0;
+        this->createdTiles = logic.spawner.createdTiles;
+        this->createdWildcardTiles = logic.spawner.createdWildcardTiles;
+
+        std::memcpy(this->effectsRandom, effects.state, sizeof(this->effectsRandom));
+        this->score = score;
+        this->coyoteTime = coyoteTime;
+
+        for (int i = 0; i < logic.board.cells.size(); i++) this->cells[i] = (int8_t)logic.board.cells[i];
+
+        this->magic = MAGIC;
+        return true;
+    }
+
+    void applyConfig(Config& config) const
+    {
+        config.gridWidth = (float)this->gridWidth;
+        config.gridHeight = (float)this->gridHeight;
+        config.tileTypes = this->tileTypes;
+        config.wildcardChance = this->wildcardChance;
+        config.powerUpBomb = this->powerUpBomb;
+        config.seed = this->seed;
+    }
+
+    // logic has to be built from the config applyConfig() produced
+    void restore(GameLogic& logic, Random& effects) const
+    {
+        logic.board.cells.assign(this->cells, this->cells + this->gridWidth * this->gridHeight);
+        std::memcpy(logic.spawner.random.state, this->boardRandom, sizeof(this->boardRandom));
+        std::memcpy(logic.layouts.state, this->layoutRandom, sizeof(this->layoutRandom));
+        logic.score = this->logicScore;
+        logic.powerUpTracker = this->powerUpTracker;
+        logic.collapseNeeded = this->collapseNeeded != 0;
+        logic.settlePending = this->settlePending != 0;
+        logic.spawner.createdTiles = this->createdTiles;
+        logic.spawner.createdWildcardTiles = this->createdWildcardTiles;
+        std::memcpy(effects.state, this->effectsRandom, sizeof(this->effectsRandom));
+    }
+};
+const uint32_t GameSnapshot::MAGIC;
+const uint32_t GameSnapshot::VERSION;
+const int GameSnapshot::MAX_CELLS;
+static_assert(std::is_trivially_copyable<GameSnapshot>::value, "GameSnapshot must stay a plain block of bytes");
+static_assert(std::is_standard_layout<GameSnapshot>::value, "GameSnapshot must stay a plain block of bytes");
+
+//====================================================================================
+//                           .: TELEMETRY EXPORT :.
+//====================================================================================
+
+// the page shared with monitors: a sequence number around a copy of the telemetry. the game
+// makes it odd while copying and even when done, a reader copies the values out and tries
+// again when the number moved or was odd, so neither side ever waits on the other
+struct SharedTelemetry
+{
+    static const uint32_t MAGIC = 0x4c54334d; // "M3TL"
+    static const uint32_t VERSION = 3;
+
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint64_t> sequence;
+    Telemetry values;
+};
+static_assert(std::is_trivially_copyable<Telemetry>::value, "Telemetry must stay a plain block of bytes");
+
+class TelemetryExport
+{
+public:
+    bool open(const std::string& path)
+    {
+        if (path.empty() || !this->file.open(path, sizeof(SharedTelemetry), true)) return false;
+        this->page = (SharedTelemetry*)this->file.data;
+        this->page->sequence.store(0, std::memory_order_relaxed);
+        this->page->magic = SharedTelemetry::MAGIC;
+        this->page->version = SharedTelemetry::VERSION;
+        return true;
+    }
+
+    void publish(const Telemetry& telemetry)
+    {
+        if (this->page == nullptr) return;
+        uint64_t sequence = this->page->sequence.load(std::memory_order_relaxed);
+        this->page->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(&this->page->values, &telemetry, sizeof(Telemetry));
+        this->page->sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    // for monitors, false when there is no page or the game is too busy writing it
+    static bool read(const SharedTelemetry* page, Telemetry& telemetry)
+    {
+        if (page->magic != SharedTelemetry::MAGIC || page->version != SharedTelemetry::VERSION) return false;
+        for (int attempt = 0; attempt < 100; attempt++)
+        {
+            uint64_t before = page->sequence.load(std::memory_order_acquire);
+            if (before & 1) continue;
+            std::memcpy(&telemetry, &page->values, sizeof(Telemetry));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (page->sequence.load(std::memory_order_relaxed) == before) return true;
+        }
+        return false;
+    }
+
+private:
+    MappedFile file;
+    SharedTelemetry* page{ nullptr };
+};
+
+// prints what a running game publishes, once a second until the game is gone
+int monitorTelemetry(const std::string& path)
+{
+    MappedFile file;
+    if (!file.open(path, 0, false) || file.size < sizeof(SharedTelemetry))
+    {
+        std::cout << "No telemetry at " << path << ", is the game running?" << std::endl;
+        return 1;
+    }
+    const SharedTelemetry* page = (const SharedTelemetry*)file.data;
+    Telemetry last;
+    bool first = true;
+    int stale = 0;
+    while (stale < 5)
+    {
+        Telemetry now;
+        if (!TelemetryExport::read(page, now))
+        {
+            std::cout << "Telemetry page unreadable" << std::endl;
+            return 1;
+        }
+        if (!first && now.frames == last.frames) stale++;
+        else stale = 0;
+        std::cout << "frames " << now.frames << " (" << (first ? 0 : now.frames - last.frames) << "/s)"
+            << " | frame p50 " << now.frameMicros.percentile(0.5) << "us p99 " << now.frameMicros.percentile(0.99) << "us"
+            << " | tick p50 " << now.tickMicros.percentile(0.5) << "us p99 " << now.tickMicros.percentile(0.99) << "us"
+            << " | scan p50 " << now.matchScanNanos.percentile(0.5) << "ns p99 " << now.matchScanNanos.percentile(0.99) << "ns"
+            << " | cascades " << now.cascades << " depth max " << now.cascadeDepth.max
+            << " | swaps " << now.swaps << " matched " << now.tilesMatched << " specials " << now.specialsCreated << "/" << now.specialsSetOff
+            << " | particles " << now.particlesAlive << " at " << now.particleQuality << "%" << " | heap " << now.heapBytes / 1024 << "KB in " << now.heapBlocks << " blocks"
+            << " | score " << now.score << std::endl;
+        last = now;
+        first = false;
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    std::cout << "No new frames, the game has stopped" << std::endl;
+    return 0;
+}
+
+//====================================================================================
+//                           .: AUTO PLAYER :.
+//====================================================================================
+
+// one full turn: the swap and every collapse and cascade it sets off
+bool playMove(GameLogic& logic, SwapMove move, CascadeLog& scratch)
+{
+    scratch.clear();
+    return logic.resolveSwap(move.from, move.to, scratch);
+}
+
+// open-loop Monte-Carlo tree search: nodes are move sequences rather than states, and every
+// iteration re-rolls the refills, so what falls in after a move is sampled like a chance node.
+// root-parallel: each worker grows its own tree and the root statistics are summed at the end
+class AutoPlayer
+{
+public:
+    float thinkTime;
+    int rolloutDepth;
+    float exploration;
+    ThreadPool pool;
+
+    long long simulatedMoves{ 0 }; // over the last search
+    int iterations{ 0 };
+
+    AutoPlayer(Config& config) :
+        thinkTime{ config.botThinkTime },
+        rolloutDepth{ config.botRolloutDepth },
+        exploration{ config.botExploration },
+        pool(config.botThreads),
+        random(config.seed ^ 0x5eedb07ULL)
+    {
+    }
+
+    bool chooseMove(const GameLogic& logic, SwapMove& move)
+    {
+        GameLogic root = logic;
+        root.pregenerator = nullptr; // simulated resets must not eat the boards the real game asked for
+        root.telemetry = nullptr;
+        std::vector<SwapMove> rootMoves;
+        legalMoves(root.board, rootMoves);
+        if (rootMoves.empty()) return false;
+        move = rootMoves[0];
+        if (rootMoves.size() == 1) return true;
+
+        int workers = this->pool.size();
+        std::vector<TreeResult> results(workers);
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::microseconds((long long)(this->thinkTime * 1e6));
+        for (int w = 0; w < workers; w++)
+        {
+            Random workerRandom = this->random.split();
+            TreeResult* result = &results[w];
+            this->pool.submit([this, &root, workerRandom, deadline, result]() { this->search(root, workerRandom, deadline, *result); });
+        }
+        this->pool.wait();
+
+        // root moves are the same in every tree, they come from the same board
+        std::vector<long long> visits(rootMoves.size(), 0);
+        this->simulatedMoves = 0;
+        this->iterations = 0;
+        for (int w = 0; w < workers; w++)
+        {
+            for (int c = 0; c < results[w].rootVisits.size(); c++) visits[c] += results[w].rootVisits[c];
+            this->simulatedMoves += results[w].simulatedMoves;
+            this->iterations += results[w].iterations;
+        }
+
+        int best = 0;
+        for (int c = 1; c < visits.size(); c++)
+        {
+            if (visits[c] > visits[best]) best = c;
+        }
+        move = rootMoves[best];
+        return true;
+    }
+
+private:
+    struct Node
+    {
+        SwapMove move;
+        int visits{ 0 };
+        double total{ 0.0 };
+        bool expanded{ false };
+        std::vector<SwapMove> untried;
+        std::vector<int> children;
+    };
+
+    struct TreeResult
+    {
+        std::vector<long long> rootVisits;
+        long long simulatedMoves{ 0 };
+        int iterations{ 0 };
+    };
+
+    Random random;
+
+    void search(const GameLogic& root, Random random, std::chrono::steady_clock::time_point deadline, TreeResult& result)
+    {
+        GameLogic sim = root;
+        std::vector<Node> tree(1);
+        legalMoves(sim.board, tree[0].untried);
+        tree[0].expanded = true;
+        // root children get created in the same order as chooseMove lists them
+        std::reverse(tree[0].untried.begin(), tree[0].untried.end());
+
+        CascadeLog scratch;
+        std::vector<SwapMove> moves;
+        std::vector<int> path;
+        double bestReward = 1.0;
+
+        while (true)
+        {
+            // checking the clock every few iterations keeps it out of the profile
+            if ((result.iterations & 15) == 0 && std::chrono::steady_clock::now() >= deadline) break;
+            result.iterations++;
+
+            sim = root;
+            sim.spawner.random.seed(random.next()); // chance: sample what falls in this time
+            path.clear();
+            path.push_back(0);
+            int node = 0;
+
+            // selection
+            while (tree[node].untried.empty() && !tree[node].children.empty())
+            {
+                node = this->select(tree, node, bestReward);
+                path.push_back(node);
+                result.simulatedMoves++;
+                if (!playMove(sim, tree[node].move, scratch)) break;
+            }
+
+            // expansion
+            if (!tree[node].expanded)
+            {
+                legalMoves(sim.board, tree[node].untried);
+                tree[node].expanded = true;
+            }
+            if (!tree[node].untried.empty())
+            {
+                Node child;
+                child.move = tree[node].untried.back();
+                tree[node].untried.pop_back();
+                tree.push_back(child);
+                int index = tree.size() - 1;
+                tree[node].children.push_back(index);
+                node = index;
+                path.push_back(node);
+                result.simulatedMoves++;
+                playMove(sim, child.move, scratch);
+            }
+
+            // rollout
+            for (int depth = 0; depth < this->rolloutDepth; depth++)
+            {
+                legalMoves(sim.board, moves);
+                if (moves.empty()) break;
+                result.simulatedMoves++;
+                playMove(sim, moves[random.nextInt(moves.size())], scratch);
+            }
+
+            double reward = sim.score - root.score;
+            if (reward > bestReward) bestReward = reward;
+            for (int p = 0; p < path.size(); p++)
+            {
+                tree[path[p]].visits++;
+                tree[path[p]].total += reward;
+            }
+        }
+
+        result.rootVisits.assign(tree[0].children.size(), 0);
+        for (int c = 0; c < tree[0].children.size(); c++) result.rootVisits[c] = tree[tree[0].children[c]].visits;
+    }
+
+    // UCB1 with rewards scaled by the best one seen so far
+    int select(const std::vector<Node>& tree, int node, double bestReward) const
+    {
+        double logVisits = std::log((double)tree[node].visits + 1.0);
+        int best = tree[node].children[0];
+        double bestValue = -1.0;
+        for (int c = 0; c < tree[node].children.size(); c++)
+        {
+            const Node& child = tree[tree[node].children[c]];
+            double value = child.total / (child.visits * bestReward) + this->exploration * std::sqrt(logVisits / child.visits);
+            if (value > bestValue)
+            {
+                bestValue = value;
+                best = tree[node].children[c];
+            }
+        }
+        return best;
+    }
+};
+
+// plays a whole game without a window, for QA runs and difficulty curves
+int autoPlay(int moves, Config& config)
+{
+    if (config.seed == 0) config.seed = (uint64_t)std::time(nullptr);
+    GameLogic logic(config, config.seed);
+    AutoPlayer bot(config);
+    ReplayRecorder recorder(config);
+    CascadeLog cascade;
+
+    std::cout << "Seed: " << config.seed << ", " << bot.pool.size() << " search threads" << std::endl;
+    long long simulated = 0;
+    double thinking = 0.0;
+    for (int turn = 0; turn < moves; turn++)
+    {
+        SwapMove move;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (!bot.chooseMove(logic, move)) break;
+        thinking += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        simulated += bot.simulatedMoves;
+
+        cascade.clear();
+        logic.resolveSwap(move.from, move.to, cascade);
+        recorder.cascade(cascade, logic.board.width, move.from, move.to);
+        std::cout << "Move " << turn + 1 << ": " << move.from << " -> " << move.to << ", +" << cascade.scoreGained() << " in " << cascade.size() << " steps, score " << logic.score << std::endl;
+    }
+
+    recorder.save("autoplay.m3r", logic.score);
+    std::cout << "Final score " << logic.score << ", " << (thinking > 0 ? simulated / thinking / bot.pool.size() : 0) << " simulated moves/s per thread" << std::endl;
+    return 0;
+}
+
+// the logic should not touch the heap once its buffers have grown to size: neither while the board
+// rests nor for a plain swap that matches, collapses and settles. fails the run otherwise
+int checkAllocations(Config& config)
+{
+    if (config.seed == 0) config.seed = 1;
+    GameLogic logic(config, config.seed);
+    CascadeLog cascade;
+    std::vector<SwapMove> moves;
+    std::vector<char> kill;
+    CascadeStep step;
+    cascade.reserve(CascadeLog::DEPTH, logic.board.cells.size());
+    step.reserve(logic.board.cells.size());
+    Random random = Random::forStream(config.seed, STREAM_PLAYERS);
+
+    // warm up, every scratch buffer reaches its working size
+    for (int turn = 0; turn < 500; turn++)
+    {
+        legalMoves(logic.board, moves);
+        if (moves.empty()) break;
+        playMove(logic, moves[random.nextInt(moves.size())], cascade);
+        findMatches(logic.board, kill);
+    }
+
+    allocationTracker.reset();
+    allocationTracker.enabled = true;
+    for (int frame = 0; frame < 1000; frame++)
+    {
+        step.clear();
+        logic.settle(step);
+        logic.collapse(step);
+        matchPossible(logic.board);
+        findMatches(logic.board, kill);
+        legalMoves(logic.board, moves);
+    }
+    uint64_t resting = allocationTracker.endFrame();
+    allocationTracker.enabled = false;
+    std::cout << "Settled board, 1000 frames: " << resting << " allocations" << std::endl;
+    if (resting > 0) allocationTracker.report(10);
+
+    // plain turns only: one match, then collapses and cascades, no specials, reshuffles or new boards
+    int plain = 0;
+    uint64_t turning = 0;
+    allocationTracker.reset();
+    for (int turn = 0; turn < 2000 && plain < 500; turn++)
+    {
+        legalMoves(logic.board, moves);
+        if (moves.empty()) break;
+        SwapMove move = moves[random.nextInt(moves.size())];
+        allocationTracker.enabled = true;
+        playMove(logic, move, cascade);
+        allocationTracker.enabled = false;
+        uint64_t made = allocationTracker.endFrame();
+        bool simple = cascade.size() > 0 && !cascade[0].detonated;
+        for (int i = 0; i < cascade.size(); i++) simple = simple && cascade[i].upgrades.empty() && !cascade[i].reshuffled && !cascade[i].reset;
+        if (!simple) continue;
+        plain++;
+        turning += made;
+    }
+    std::cout << "Swap and match, " << plain << " plain turns: " << turning << " allocations" << std::endl;
+    if (turning > 0) allocationTracker.report(10);
+
+    bool clean = resting == 0 && turning == 0;
+    std::cout << (clean ? "No allocations in the steady state" : "Steady state ALLOCATES") << std::endl;
+    return clean ? 0 : 1;
+}
+
+// times reshuffles and simulated turns with the transient buffers on the heap and in the frame arena, best of
+// two alternating passes each. every pass sees the same boards and moves so they have to end up with the same results
+int benchmarkArena(Config& config)
+{
+    const int shuffles = 20000;
+    const int games = 300;
+    const int turns = 30;
+    double shuffleSeconds[2] = { 1e9, 1e9 };
+    double turnSeconds[2] = { 1e9, 1e9 };
+    long long played[4] = { 0, 0, 0, 0 };
+    long long checksum[4] = { 0, 0, 0, 0 };
+
+    for (int pass = 0; pass < 4; pass++)
+    {
+        FrameArena::heapOnly = pass % 2 == 0;
+
+        Random random(1);
+        Board board((int)config.gridWidth, (int)config.gridHeight);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int b = 0; b < shuffles; b++)
+        {
+            for (int i = 0; i < board.cells.size(); i++) board.cells[i] = random.nextInt(20) == 0 ? random.nextInt(TILE_TYPES) : random.nextInt(5);
+            if (shuffleBoard(board, random)) checksum[pass] += board.cells[b % board.cells.size()];
+        }
+        shuffleSeconds[pass % 2] = std::min(shuffleSeconds[pass % 2], std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+        // the same kind of games the bot rolls out
+        GameLogic root(config, 1);
+        GameLogic sim = root;
+        CascadeLog cascade;
+        std::vector<SwapMove> moves;
+        Random players = Random::forStream(1, STREAM_PLAYERS);
+        start = std::chrono::steady_clock::now();
+        for (int g = 0; g < games; g++)
+        {
+            sim = root;
+            sim.spawner.random.seed(players.next());
+            for (int t = 0; t < turns; t++)
+            {
+                legalMoves(sim.board, moves);
+                if (moves.empty()) break;
+                playMove(sim, moves[players.nextInt(moves.size())], cascade);
+                played[pass]++;
+            }
+            checksum[pass] += sim.score;
+        }
+        turnSeconds[pass % 2] = std::min(turnSeconds[pass % 2], std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    FrameArena::heapOnly = !config.frameArena;
+
+    std::cout << "Reshuffle: heap " << shuffleSeconds[0] * 1e9 / shuffles << " ns -> arena " << shuffleSeconds[1] * 1e9 / shuffles << " ns ("
+        << shuffleSeconds[0] / shuffleSeconds[1] << "x), simulated turn: heap " << turnSeconds[0] * 1e9 / played[0] << " ns -> arena "
+        << turnSeconds[1] * 1e9 / played[1] << " ns (" << turnSeconds[0] / turnSeconds[1] << "x)" << std::endl;
+    bool agree = true;
+    for (int pass = 1; pass < 4; pass++) agree = agree && checksum[pass] == checksum[0] && played[pass] == played[0];
+    std::cout << (agree ? "Arena and heap runs agree" : "Arena and heap runs DISAGREE") << std::endl;
+    return agree ? 0 : 1;
+}
+
+//====================================================================================
+//                           .: MOVE VALIDATION :.
+//====================================================================================
+
+// FNV-1a over the cells, cheap enough to send with every move
+uint64_t boardHash(const Board& board)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < board.cells.size(); i++)
+    {
+        hash ^= (uint8_t)board.cells[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// what a client says happened: the state before its move, the swap, and the outcome of the whole turn
+struct MoveClaim
+{
+    const GameSnapshot* before;
+    SwapMove move;
+    int32_t scoreGained;
+    uint64_t boardAfter; // boardHash of the settled board, 0 skips the check
+};
+
+enum class MoveVerdict : uint8_t
+{
+    VALID,
+    BAD_SNAPSHOT,
+    ILLEGAL_SWAP, // not neighbours, or nothing matched and nothing went off
+    WRONG_SCORE,
+    WRONG_BOARD
+};
+
+// re-resolves claimed moves on its own scratch game, with no SFML and no globals, so every worker
+// thread can own one. the scratch game is only rebuilt when a claim comes from a different config
+class MoveValidator
+{
+public:
+    void validate(const MoveClaim* claims, int count, MoveVerdict* verdicts)
+    {
+        for (int i = 0; i < count; i++) verdicts[i] = this->validate(claims[i]);
+    }
+
+    MoveVerdict validate(const MoveClaim& claim)
+    {
+        const GameSnapshot& before = *claim.before;
+        if (!before.valid()) return MoveVerdict::BAD_SNAPSHOT;
+        this->prepare(before);
+
+        GameLogic& game = *this->scratch;
+        before.restore(game, this->effects);
+        this->cascade.clear();
+        int scoreBefore = game.score;
+        if (!game.resolveSwap(claim.move.from, claim.move.to, this->cascade)) return MoveVerdict::ILLEGAL_SWAP;
+        if (game.score - scoreBefore != claim.scoreGained) return MoveVerdict::WRONG_SCORE;
+        if (claim.boardAfter != 0 && boardHash(game.board) != claim.boardAfter) return MoveVerdict::WRONG_BOARD;
+        return MoveVerdict::VALID;
+    }
+
+private:
+    Config config;
+    std::unique_ptr<GameLogic> scratch;
+    Random effects;
+    CascadeLog cascade;
+
+    void prepare(const GameSnapshot& before)
+    {
+        if (this->scratch && before.gridWidth == (int)this->config.gridWidth && before.gridHeight == (int)this->config.gridHeight
+            && before.tileTypes == this->config.tileTypes && before.wildcardChance == this->config.wildcardChance
+            && before.powerUpBomb == this->config.powerUpBomb)
+        {
+            return;
+        }
+        before.applyConfig(this->config);
+        this->scratch.reset(new GameLogic(this->config, before.seed));
+    }
+};
+
+// headless throughput check: claims taken from real play, some of them tampered with, validated on one thread
+int benchmarkValidation(int claims, Config& config)
+{
+    if (config.seed == 0) config.seed = (uint64_t)std::time(nullptr);
+    const int turns = 1024;
+    std::vector<GameSnapshot> snapshots(turns);
+    std::vector<MoveClaim> honest(turns);
+    GameLogic game(config, config.seed);
+    Random picker = Random::forStream(config.seed, STREAM_PLAYERS);
+    Random effects;
+    std::vector<SwapMove> moves;
+    CascadeLog cascade;
+    for (int t = 0; t < turns; t++)
+    {
+        snapshots[t].capture(game, config, game.score, 0.0f, effects);
+        legalMoves(game.board, moves);
+        SwapMove move = moves[picker.nextInt(moves.size())];
+        int scoreBefore = game.score;
+        playMove(game, move, cascade);
+        honest[t] = { &snapshots[t], move, game.score - scoreBefore, boardHash(game.board) };
+    }
+
+    // one in ten claims the wrong score, one in ten swaps cells that are not neighbours
+    std::vector<MoveClaim> batch(claims);
+    std::vector<MoveVerdict> expected(claims);
+    for (int i = 0; i < claims; i++)
+    {
+        batch[i] = honest[i % turns];
+        expected[i] = MoveVerdict::VALID;
+        if (i % 10 == 3)
+        {
+            batch[i].scoreGained++;
+            expected[i] = MoveVerdict::WRONG_SCORE;
+        }
+        else if (i % 10 == 7)
+        {
+            batch[i].move.to = batch[i].move.from;
+            expected[i] = MoveVerdict::ILLEGAL_SWAP;
+        }
+    }
+
+    MoveValidator validator;
+    std::vector<MoveVerdict> verdicts(claims);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    validator.validate(batch.data(), claims, verdicts.data());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int wrong = 0;
+    for (int i = 0; i < claims; i++) wrong += verdicts[i] != expected[i];
+    std::cout << claims << " claims in " << seconds << " s, " << claims / seconds << " validations/s on one thread, " << wrong << " wrong verdicts" << std::endl;
+    return wrong == 0 ? 0 : 1;
+}
+
+//==========================================================================
+//                     .: LEADERBOARD :.
+//==========================================================================
+
+struct LeaderboardEntry
+{
+    uint64_t player;
+    int score;
+};
+
+// best first, ties go to the lower player id
+struct LeaderboardOrder
+{
+    bool operator()(const LeaderboardEntry& a, const LeaderboardEntry& b) const
+    {
+        if (a.score != b.score) return a.score > b.score;
+        return a.player < b.player;
+    }
+};
+
+// scores of many sessions, written from any thread. players are spread over shards that each have
+// their own lock, so writers only meet when they hit the same shard. next to the shards a Fenwick tree
+// of atomic counts per score answers "how many players are above this score" without locking anything,
+// which makes a rank O(log scoreRange). every shard also keeps its best players in order, only an update
+// that gets near the top touches that set, and top-K merges the first K of each.
+// while writes are in flight a rank may be off by the updates not finished yet, once they stop it is exact.
+// scores past the range are ranked as the top of it, they still sort correctly in top()
+class Leaderboard
+{
+public:
+    static const int SHARDS = 64;
+    static const int KEPT = 256; // best players kept in order per shard, the most top() returns
+    static const uint8_t VERSION = 1;
+
+    Leaderboard(int scoreRange) :
+        scoreRange{ std::max(scoreRange, 1) },
+        counts(new std::atomic<int32_t>[this->scoreRange + 1])
+    {
+        for (int i = 0; i <= this->scoreRange; i++) this->counts[i].store(0, std::memory_order_relaxed);
+    }
+
+    Leaderboard(const Leaderboard&) = delete;
+    Leaderboard& operator=(const Leaderboard&) = delete;
+
+    // the player's current score, replaces the one reported before
+    void report(uint64_t player, int score)
+    {
+        score = std::max(score, 0);
+        Shard& shard = this->shardOf(player);
+        int previous = -1;
+        {
+            std::lock_guard<std::mutex> lock(shard.lock);
+            std::pair<std::unordered_map<uint64_t, int>::iterator, bool> found = shard.scores.insert({ player, score });
+            if (!found.second)
+            {
+                previous = found.first->second;
+                if (previous == score) return;
+                found.first->second = score;
+                shard.forget({ player, previous });
+            }
+            shard.consider({ player, score });
+        }
+        if (previous >= 0) this->recount(previous, score);
+        else
+        {
+            this->players.fetch_add(1, std::memory_order_relaxed);
+            this->count(score, 1);
+        }
+    }
+
+    // 1 for the best score, players on the same score share a rank. 0 when the player never reported
+    int rank(uint64_t player)
+    {
+        int score;
+        {
+            Shard& shard = this->shardOf(player);
+            std::lock_guard<std::mutex> lock(shard.lock);
+            std::unordered_map<uint64_t, int>::const_iterator found = shard.scores.find(player);
+            if (found == shard.scores.end()) return 0;
+            score = found->second;
+        }
+        return 1 + this->countAbove(score);
+    }
+
+    // the best count players in order, at most KEPT, returns how many there were
+    int top(int count, std::vector<LeaderboardEntry>& out)
+    {
+        count = std::min(count, KEPT);
+        out.clear();
+        for (int s = 0; s < SHARDS; s++)
+        {
+            std::lock_guard<std::mutex> lock(this->shards[s].lock);
+            std::set<LeaderboardEntry, LeaderboardOrder>::const_iterator it = this->shards[s].ranked.begin();
+            for (int i = 0; i < count && it != this->shards[s].ranked.end(); i++, ++it) out.push_back(*it);
+        }
+        count = std::min(count, (int)out.size());
+        std::partial_sort(out.begin(), out.begin() + count, out.end(), LeaderboardOrder());
+        out.resize(count);
+        return count;
+    }
+
+    int size() const
+    {
+        return this->players.load(std::memory_order_relaxed);
+    }
+
+    // written next to the file and renamed over it, so a crash mid-write leaves the last checkpoint intact.
+    // shards are copied one at a time, a checkpoint taken under load holds each player's score at some point of it
+    bool checkpoint(const std::string& path)
+    {
+        std::vector<uint8_t> bytes;
+        const char magic[] = { 'M', '3', 'L', 'B' };
+        bytes.insert(bytes.end(), magic, magic + 4);
+        bytes.push_back(VERSION);
+        std::vector<LeaderboardEntry> entries;
+        for (int s = 0; s < SHARDS; s++)
+        {
+            std::lock_guard<std::mutex> lock(this->shards[s].lock);
+            for (std::unordered_map<uint64_t, int>::const_iterator it = this->shards[s].scores.begin(); it != this->shards[s].scores.end(); ++it)
+            {
+                entries.push_back({ it->first, it->second });
+            }
+        }
+        writeVarint(bytes, entries.size());
+        for (int i = 0; i < entries.size(); i++)
+        {
+            writeVarint(bytes, entries[i].player);
+            writeVarint(bytes, entries[i].score);
+        }
+
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary);
+            file.write((const char*)bytes.data(), bytes.size());
+            if (!file.good()) return false;
+        }
+        std::remove(path.c_str()); // rename does not replace on Windows
+        return std::rename(temporary.c_str(), path.c_str()) == 0;
+    }
+
+    // adds the players of a checkpoint, false when the file is missing or damaged
+    bool restore(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (!file.is_open()) return false;
+        const uint8_t* data = bytes.data();
+        const uint8_t* end = data + bytes.size();
+        if (bytes.size() < 5 || data[0] != 'M' || data[1] != '3' || data[2] != 'L' || data[3] != 'B' || data[4] != VERSION) return false;
+        data += 5;
+
+        uint64_t entries;
+        if (!readVarint(data, end, entries)) return false;
+        for (uint64_t i = 0; i < entries; i++)
+        {
+            uint64_t player, score;
+            if (!readVarint(data, end, player) || !readVarint(data, end, score)) return false;
+            this->report(player, (int)score);
+        }
+        return true;
+    }
+
+private:
+    struct alignas(64) Shard
+    {
+        std::mutex lock;
+        std::unordered_map<uint64_t, int> scores;
+        std::set<LeaderboardEntry, LeaderboardOrder> ranked; // always the best ranked.size() of scores
+
+        void forget(const LeaderboardEntry& entry)
+        {
+            this->ranked.erase(entry);
+        }
+
+        // scores already holds the entry
+        void consider(const LeaderboardEntry& entry)
+        {
+            bool complete = this->ranked.size() + 1 >= this->scores.size();
+            if (complete || LeaderboardOrder()(entry, *this->ranked.rbegin()))
+            {
+                this->ranked.insert(entry);
+                if (this->ranked.size() > 2 * KEPT) this->ranked.erase(std::prev(this->ranked.end()));
+            }
+            else if (this->ranked.size() < KEPT) this->rebuild();
+        }
+
+        // players fell out of the kept ones, refill them from all of the shard
+        void rebuild()
+        {
+            std::vector<LeaderboardEntry> all;
+            all.reserve(this->scores.size());
+            for (std::unordered_map<uint64_t, int>::const_iterator it = this->scores.begin(); it != this->scores.end(); ++it)
+            {
+                all.push_back({ it->first, it->second });
+            }
+            int kept = std::min((int)all.size(), 2 * KEPT);
+            std::partial_sort(all.begin(), all.begin() + kept, all.end(), LeaderboardOrder());
+            this->ranked.clear();
+            this->ranked.insert(all.begin(), all.begin() + kept);
+        }
+    };
+
+    int scoreRange;
+    std::unique_ptr<std::atomic<int32_t>[]> counts; // Fenwick tree, slot 0 is the best score
+    std::atomic<int> players{ 0 };
+    Shard shards[SHARDS];
+
+    Shard& shardOf(uint64_t player)
+    {
+        return this->shards[(player * 0x9e3779b97f4a7c15ULL) >> 58];
+    }
+
+    int slot(int score) const
+    {
+        return this->scoreRange - 1 - std::min(score, this->scoreRange - 1);
+    }
+
+    void count(int score, int32_t change)
+    {
+        for (int i = this->slot(score) + 1; i <= this->scoreRange; i += i & -i) this->counts[i].fetch_add(change, std::memory_order_relaxed);
+    }
+
+    // one player moving between scores: past the node where the two paths meet the -1 and +1 cancel out,
+    // and a score going up a little usually meets its old path within a couple of nodes
+    void recount(int from, int to)
+    {
+        int i = this->slot(from) + 1;
+        int j = this->slot(to) + 1;
+        while (i != j)
+        {
+            if (i < j)
+            {
+                if (i > this->scoreRange) break;
+                this->counts[i].fetch_sub(1, std::memory_order_relaxed);
+                i += i & -i;
+            }
+            else
+            {
+                if (j > this->scoreRange) break;
+                this->counts[j].fetch_add(1, std::memory_order_relaxed);
+                j += j & -j;
+            }
+        }
+    }
+
+    int countAbove(int score) const
+    {
+        int32_t total = 0;
+        for (int i = this->slot(score); i > 0; i -= i & -i) total += this->counts[i].load(std::memory_order_relaxed);
+        return total;
+    }
+};
+const int Leaderboard::SHARDS;
+const int Leaderboard::KEPT;
+const uint8_t Leaderboard::VERSION;
+
+// many threads report at once, each owns a slice of the players so the final scores are known. scores only
+// go up, by what a move or a short cascade is worth, like the sessions report them. then ranks, top-K and
+// a checkpoint round trip are checked against a plain sort
+int benchmarkLeaderboard(int players, int updates, Config& config)
+{
+    if (config.seed == 0) config.seed = 1;
+    int threads = std::max(1, (int)std::thread::hardware_concurrency());
+    Leaderboard leaderboard(config.leaderboardScoreRange);
+    std::vector<int> truth(players, -1);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::thread> writers;
+    for (int t = 0; t < threads; t++)
+    {
+        writers.push_back(std::thread([&, t]()
+        {
+            Random random = Random::forStream(config.seed + t, STREAM_PLAYERS);
+            int slice = (players + threads - 1) / threads;
+            int first = t * slice;
+            int last = std::min(players, first + slice);
+            if (first >= last) return;
+            for (int u = t; u < updates; u += threads)
+            {
+                int player = first + random.nextInt(last - first);
+                int score = std::max(truth[player], 0) + 3 + random.nextInt(30);
+                leaderboard.report(player, score);
+                truth[player] = score;
+            }
+        }));
+    }
+    for (int t = 0; t < writers.size(); t++) writers[t].join();
+    double writing = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<LeaderboardEntry> sorted;
+    for (int p = 0; p < players; p++)
+    {
+        if (truth[p] >= 0) sorted.push_back({ (uint64_t)p, truth[p] });
+    }
+    std::sort(sorted.begin(), sorted.end(), LeaderboardOrder());
+    bool agree = leaderboard.size() == sorted.size();
+
+    const int queries = sorted.empty() ? 0 : 100000;
+    std::vector<uint64_t> asked(queries);
+    std::vector<int> expected(queries);
+    std::vector<int> answered(queries);
+    Random random(config.seed);
+    for (int q = 0; q < queries; q++)
+    {
+        const LeaderboardEntry& sample = sorted[random.nextInt(sorted.size())];
+        asked[q] = sample.player;
+        expected[q] = (int)(std::lower_bound(sorted.begin(), sorted.end(), LeaderboardEntry{ 0, sample.score }, LeaderboardOrder()) - sorted.begin()) + 1;
+    }
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < queries; q++) answered[q] = leaderboard.rank(asked[q]);
+    double ranking = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    agree = agree && answered == expected;
+
+    std::vector<LeaderboardEntry> best;
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < 1000; q++) leaderboard.top(10, best);
+    double topping = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (int i = 0; i < best.size(); i++) agree = agree && best[i].player == sorted[i].player && best[i].score == sorted[i].score;
+
+    const std::string path = "leaderboard_check.m3l";
+    start = std::chrono::steady_clock::now();
+    bool saved = leaderboard.checkpoint(path);
+    double saving = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Leaderboard restored(config.leaderboardScoreRange);
+    std::vector<LeaderboardEntry> restoredBest;
+    agree = agree && saved && restored.restore(path) && restored.size() == leaderboard.size();
+    std::remove(path.c_str());
+    restored.top(100, restoredBest);
+    leaderboard.top(100, best);
+    for (int i = 0; agree && i < best.size(); i++) agree = restoredBest[i].player == best[i].player && restoredBest[i].score == best[i].score;
+
+    std::cout << updates << " updates from " << threads << " threads for " << leaderboard.size() << " players: " << updates / writing / 1e6 << " M/s" << std::endl;
+    std::cout << "Rank " << ranking * 1e9 / queries << " ns, top 10 " << topping * 1e6 / 1000 << " us, checkpoint " << saving * 1e3 << " ms" << std::endl;
+    std::cout << (agree ? "Leaderboard agrees with a plain sort" : "Leaderboard DISAGREES with a plain sort") << std::endl;
+    return agree ? 0 : 1;
+}
+
+//==========================================================================
+//                     .: SESSION HOST :.
+//==========================================================================
+
+struct PendingMove
+{
+    SwapMove move;
+    std::chrono::steady_clock::time_point submitted;
+    int picked; // see PlayedMove
+};
+
+// an accepted move, as the session journal keeps it
+struct PlayedMove
+{
+    SwapMove move;
+    int32_t scoreGained;
+    int32_t picked; // the simulated player drew it from this many legal moves, 0 for a submitted move
+};
+
+// one player's game on the host with its own config, rules state, random streams, score and observers.
+// nothing here touches the window globals, so sessions run on any worker
+class GameSession
+{
+public:
+    int id;
+    int home; // worker it is pinned to, so its board stays warm in that core's cache
+    uint64_t seed;
+    Config config;
+    GameLogic logic;
+    Scoreboard scoreboard;
+    Subject events;
+    MatchObserver scoreKeeper;
+    bool simulated; // plays a random legal move every tick instead of waiting for submitted ones
+    Random player;
+    CascadeLog cascade;
+    std::vector<SwapMove> legal;
+    std::vector<float> latencies; // microseconds from submit to resolved, collected by SessionHost::stats
+    int movesPlayed{ 0 };
+    int movesRejected{ 0 };
+    Leaderboard* leaderboard{ nullptr }; // optional, told the score after every accepted move
+    std::vector<PlayedMove> played; // accepted during the last tick, in order, picked up by SessionJournal::record
+
+    GameSession(int id, int home, const Config& config, uint64_t seed, bool simulated) :
+        id{ id },
+        home{ home },
+        seed{ seed },
+        config(config),
+        logic(this->config, seed),
+        scoreKeeper(this->scoreboard),
+        simulated{ simulated },
+        player(Random::forStream(seed, STREAM_PLAYERS))
+    {
+        this->scoreboard.announce = false;
+        this->events.addObserver(&this->scoreKeeper);
+    }
+
+    GameSession(const GameSession&) = delete;
+    GameSession& operator=(const GameSession&) = delete;
+
+    void submit(SwapMove move)
+    {
+        std::lock_guard<std::mutex> lock(this->inboxLock);
+        this->inbox.push_back({ move, std::chrono::steady_clock::now(), 0 });
+    }
+
+    // resolves everything submitted since the last tick, on whichever worker runs it
+    void tick(std::chrono::steady_clock::time_point tickStart)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->inboxLock);
+            this->working.swap(this->inbox);
+        }
+        this->played.clear();
+        if (this->simulated)
+        {
+            legalMoves(this->logic.board, this->legal);
+            if (!this->legal.empty()) this->working.push_back({ this->legal[this->player.nextInt(this->legal.size())], tickStart, (int)this->legal.size() });
+        }
+
+        for (int i = 0; i < this->working.size(); i++)
+        {
+            this->cascade.clear();
+            if (this->logic.resolveSwap(this->working[i].move.from, this->working[i].move.to, this->cascade))
+            {
+                this->accepted(this->working[i].move, this->working[i].picked);
+            }
+            else
+            {
+                this->movesRejected++;
+            }
+            this->latencies.push_back(std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - this->working[i].submitted).count());
+        }
+        this->working.clear();
+    }
+
+    // a move read back from the journal, false when it does not play out the way it was recorded
+    bool redo(const PlayedMove& played)
+    {
+        if (played.picked > 0) this->player.nextInt(played.picked);
+        this->cascade.clear();
+        if (!this->logic.resolveSwap(played.move.from, played.move.to, this->cascade)) return false;
+        this->accepted(played.move, played.picked);
+        return this->cascade.scoreGained() == played.scoreGained;
+    }
+
+private:
+    std::mutex inboxLock;
+    std::vector<PendingMove> inbox;
+    std::vector<PendingMove> working;
+
+    void accepted(SwapMove move, int picked)
     {
-        this->defaultFont = new sf::Font();
-        this->defaultFont->loadFromFile("./assets/fonts/Roboto-Bold.ttf");
+        this->movesPlayed++;
+        Event event(Event::EventType::EventMatch, this->cascade.scoreGained());
+        if (event.payload > 0) this->events.notify(&event);
+        if (this->leaderboard) this->leaderboard->report(this->id, this->scoreboard.score);
+        this->played.push_back({ move, this->cascade.scoreGained(), picked });
     }
 };
-Fonts fontsLibrary;
 
-class GameAssets
+struct HostStats
+{
+    int sessions;
+    int workers;
+    long long moves;
+    double seconds; // spent inside tick()
+    float p50; // move latency in microseconds
+    float p99;
+    long long steals;
+};
+
+// owns many independent sessions and resolves them on a work-stealing pool. each tick hands every
+// session to its home worker in small batches, workers that finish early steal batches from the others
+class SessionHost
 {
 public:
-    sf::Sprite backgroundSprite;
-    sf::Sprite scoreSprite;
+    static const int BATCH = 32; // sessions per task
 
-    void loadSprites()
+    Config config;
+    WorkStealingPool pool;
+    std::vector<std::unique_ptr<GameSession>> sessions;
+    Leaderboard* leaderboard{ nullptr }; // handed to sessions opened after it is set
+
+    SessionHost(const Config& config, int threads) :
+        config(config),
+        pool(threads),
+        homeSessions(pool.size())
     {
-        this->backgroundSprite.setTexture(*textures.backgroundTexture);
-        this->backgroundSprite.setScale(config.tileWidth * config.gridWidth / this->backgroundSprite.getTexture()->getSize().x, config.tileWidth * (config.gridHeight + 1) / this->backgroundSprite.getTexture()->getSize().y);
-        this->backgroundSprite.setPosition({ config.minx - config.tileWidth / 2, config.miny - config.tileWidth / 2 });
+    }
 
-        this->scoreSprite.setTexture(*textures.scoreTexture);
-        this->scoreSprite.setScale(config.tileWidth * 2 / this->scoreSprite.getTexture()->getSize().x, config.tileWidth / this->scoreSprite.getTexture()->getSize().y);
-        this->scoreSprite.setPosition({ config.minx + config.tileWidth * config.gridWidth - config.tileWidth / 2, config.miny - config.tileWidth / 2 });
+    int open(uint64_t seed, bool simulated)
+    {
+        int id = this->sessions.size();
+        int home = id % this->pool.size();
+        this->sessions.push_back(std::unique_ptr<GameSession>(new GameSession(id, home, this->config, seed, simulated)));
+        this->sessions.back()->leaderboard = this->leaderboard;
+        this->homeSessions[home].push_back(this->sessions.back().get());
+        return id;
     }
-};
-GameAssets gameAssets;
 
-class Event
-{
-public:
-    enum class EventType
+    // safe from any thread, resolved on the next tick
+    void submit(int session, SwapMove move)
     {
-        EventMatch,
-        EventSound
-    };
+        this->sessions[session]->submit(move);
+    }
 
-    Event(Event::EventType type, int payload):
-        type{ type },
-        payload{ payload }
+    void tick()
     {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int worker = 0; worker < this->homeSessions.size(); worker++)
+        {
+            std::vector<GameSession*>& pinned = this->homeSessions[worker];
+            for (int first = 0; first < pinned.size(); first += BATCH)
+            {
+                GameSession** batch = pinned.data() + first;
+                int count = std::min(BATCH, (int)pinned.size() - first);
+                this->pool.submit(worker, [batch, count, start]()
+                {
+                    for (int i = 0; i < count; i++) batch[i]->tick(start);
+                });
+            }
+        }
+        this->pool.wait();
+        this->busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
 
+    // latencies since the last call
+    HostStats stats()
+    {
+        HostStats stats{ (int)this->sessions.size(), this->pool.size(), 0, this->busy, 0.0f, 0.0f, this->pool.steals() };
+        std::vector<float> all;
+        for (int i = 0; i < this->sessions.size(); i++)
+        {
+            all.insert(all.end(), this->sessions[i]->latencies.begin(), this->sessions[i]->latencies.end());
+            this->sessions[i]->latencies.clear();
+        }
+        stats.moves = all.size();
+        if (all.empty()) return stats;
+        std::nth_element(all.begin(), all.begin() + all.size() / 2, all.end());
+        stats.p50 = all[all.size() / 2];
+        std::nth_element(all.begin(), all.begin() + all.size() * 99 / 100, all.end());
+        stats.p99 = all[all.size() * 99 / 100];
+        return stats;
     }
 
-    EventType type;
-    int payload;
+private:
+    std::vector<std::vector<GameSession*>> homeSessions;
+    double busy{ 0.0 };
 };
+const int SessionHost::BATCH;
 
-class SoundLibrary
+//==========================================================================
+//                     .: SESSION JOURNAL :.
+//==========================================================================
+
+// a file that is only ever appended to, sync() returns once what was written is on the disk
+class AppendFile
 {
 public:
-    std::vector<sf::SoundBuffer*> soundBuffers;
-    std::vector<sf::Sound*> sounds;
-    enum SoundMapper
+    AppendFile()
     {
-        SOUND_MATCH
-    };
+    }
 
-    void loadSounds()
+    AppendFile(const AppendFile&) = delete;
+    AppendFile& operator=(const AppendFile&) = delete;
+
+    ~AppendFile()
     {
-        sf::SoundBuffer* s = new sf::SoundBuffer();
-        s->loadFromFile("./assets/sounds/impactBell_heavy_000.ogg");
-        soundBuffers.push_back(s);
+        this->close();
+    }
 
-        sf::Sound* sound = new sf::Sound(*s);
-        sounds.push_back(sound);
+    bool open(const std::string& path)
+    {
+        this->close();
+#ifdef _WIN32
+        this->file = CreateFileA(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        return this->file != INVALID_HANDLE_VALUE;
+#else
+        this->fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        return this->fd >= 0;
+#endif
+    }
+
+    bool write(const uint8_t* data, size_t size)
+    {
+        while (size > 0)
+        {
+#ifdef _WIN32
+            DWORD written = 0;
+            if (!WriteFile(this->file, data, (DWORD)std::min(size, (size_t)1 << 30), &written, nullptr)) return false;
+#else
+            ssize_t written = ::write(this->fd, data, size);
+            if (written < 0 && errno == EINTR) continue;
+            if (written < 0) return false;
+#endif
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
 
+    bool sync()
+    {
+#ifdef _WIN32
+        return FlushFileBuffers(this->file) != 0;
+#else
+        return fsync(this->fd) == 0;
+#endif
     }
 
-    void play(Event* e)
+    void close()
     {
-        sounds[e->payload]->play();
+#ifdef _WIN32
+        if (this->file != INVALID_HANDLE_VALUE) CloseHandle(this->file);
+        this->file = INVALID_HANDLE_VALUE;
+#else
+        if (this->fd >= 0) ::close(this->fd);
+        this->fd = -1;
+#endif
     }
-};
-SoundLibrary soundLibrary;
 
-//==============================================================================================
-//                                   .: CLASS - TILE :.
-//==============================================================================================
+private:
+#ifdef _WIN32
+    HANDLE file{ INVALID_HANDLE_VALUE };
+#else
+    int fd{ -1 };
+#endif
+};
 
-std::vector<std::string> tileTypeToColor = { "RED", "GREEN", "BLUE", "YELLOW", "PURPLE", "WILDCARD", "BOMB" };
+// the new file takes the old one's place in one step, a crash leaves one or the other
+bool replaceFile(const std::string& from, const std::string& to)
+{
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
 
-class Tile: public sf::Drawable
+// FNV-1a, catches records torn or garbled by a crash
+uint32_t journalChecksum(const uint8_t* data, size_t size)
 {
-public:
-    enum class TileType
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++)
     {
-        RED = 0,
-        GREEN = 1,
-        BLUE = 2,
-        YELLOW = 3,
-        PURPLE = 4,
-        WILDCARD = 5,
-        BOMB = 6
-    };
-
-    sf::Texture* tileTexture;
-    TileType type;
-    sf::Sprite tileSprite;
-    sf::Vector2f position;
-    bool selected;
-    sf::Sprite selectorSprite;
-    bool moving;
-    float currentStep;
-    float totalDuration;
-    sf::Vector2f origin, destination;
-    bool dead;
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
-    Tile()
-    {
+enum JournalOp
+{
+    JOURNAL_OPEN = 0, // session, seed, simulated
+    JOURNAL_MOVE = 1 // session, cell << 2 | direction (the replay swap ops), score gained, picked
+};
 
-    }
+struct JournalStats
+{
+    int sessions{ 0 };
+    long long moves{ 0 };
+    int segments{ 0 }; // read past the snapshot
+    double seconds{ 0.0 };
+};
 
-    Tile(TileType type, sf::Vector2f position, sf::Vector2f sizeInGameWorld)
+// crash-safe record of the hosted sessions. every tick the moves the sessions accepted are appended
+// to the current segment as checksummed records, and one fsync covers the whole tick of every session.
+// the writer runs on its own thread and takes whatever piled up while it was syncing, so under load
+// more records share a sync. full segments are closed and a compactor thread folds them into the
+// snapshot - its own copy of every session brought up to date and written out whole - and deletes
+// them. recovery loads the snapshot and redoes the segments after it, each session on its own
+// worker, a torn record at the end of a segment and everything after it in that segment is dropped.
+//
+// files: <path>.snapshot, and <path>.<n> for the segments, numbered in the order they were written
+class SessionJournal
+{
+public:
+    static const uint8_t VERSION = 1;
+
+    std::string path;
+    size_t segmentBytes;
+    std::atomic<uint64_t> records{ 0 };
+    std::atomic<uint64_t> syncs{ 0 };
+    std::atomic<uint64_t> compactions{ 0 };
+
+    SessionJournal(const std::string& path, size_t segmentBytes, const Config& config) :
+        path(path),
+        segmentBytes{ std::max(segmentBytes, (size_t)4096) },
+        config(config)
     {
-        this->type = type;
-        this->position = position;
-        this->selected = false;
-        this->moving = false;
-        this->currentStep = 0.0f;
-        this->totalDuration = 0.0f;
-        this->dead = false;
+    }
 
-        this->tileSprite.setTexture(*this->getTextureForTile(type));
-        this->tileSprite.setOrigin(this->tileSprite.getTexture()->getSize().x / 2, this->tileSprite.getTexture()->getSize().y / 2);
-        this->tileSprite.setScale({ sizeInGameWorld.x / this->tileSprite.getTexture()->getSize().x , sizeInGameWorld.y / this->tileSprite.getTexture()->getSize().y});
-        this->tileSprite.setPosition(this->position);
+    SessionJournal(const SessionJournal&) = delete;
+    SessionJournal& operator=(const SessionJournal&) = delete;
 
-        this->selectorSprite.setTexture(*textures.selectorTexture);
-        this->selectorSprite.setOrigin(this->selectorSprite.getTexture()->getSize().x / 2, this->selectorSprite.getTexture()->getSize().y / 2);
-        this->selectorSprite.setScale({ sizeInGameWorld.x / this->selectorSprite.getTexture()->getSize().x , sizeInGameWorld.y / this->selectorSprite.getTexture()->getSize().y });
-        this->selectorSprite.setPosition(this->position);
+    ~SessionJournal()
+    {
+        this->stop();
     }
 
-    void update(float dt)
+    // brings back the sessions on disk into an empty host, before start(). false when the files are
+    // damaged, were written with different game settings, or a move does not play out as recorded
+    bool recover(SessionHost& host, JournalStats& stats)
     {
-		if (this->moving)
-		{
-			this->currentStep += dt;
-			if (this->currentStep > this->totalDuration)
-			{
-				this->currentStep = 0.0f;
-                this->totalDuration = 0.0f;
-				this->moving = false;
-                //std::cout << "Stopped moving" << std::endl;
-			}
-			else
-			{
-				this->position = lerp(this->origin, this->destination, this->currentStep / this->totalDuration);
-				this->tileSprite.setPosition(this->position);
-				this->selectorSprite.setPosition(this->position);
-			}
-		}
-        else
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::vector<std::vector<PlayedMove>> moves;
+        std::function<GameSession&(uint64_t, bool)> open = [&host](uint64_t seed, bool simulated) -> GameSession&
+        {
+            return *host.sessions[host.open(seed, simulated)];
+        };
+
+        uint64_t segment;
+        if (!this->readSnapshot(open, moves, segment)) return false;
+        this->folded = segment;
+        // a crash between writing the snapshot and deleting what it holds leaves those segments behind
+        for (uint64_t stale = segment; stale-- > 0 && std::remove(this->segmentPath(stale).c_str()) == 0;)
         {
-			//std::cout << "Tile not moving" << std::endl;
         }
-    }
+        while (true)
+        {
+            int read = this->readSegment(segment, open, moves, stats.moves);
+            if (read == SEGMENT_BAD) return false;
+            if (read == SEGMENT_MISSING) break;
+            segment++;
+        }
+        stats.segments = (int)(segment - this->folded);
+        this->segment = segment;
 
-    void move(sf::Vector2f pos, float animationDuration)
-    {
-        this->origin = this->position;
-        this->destination = pos;
-        this->moving = true;
-        this->currentStep = 0.0f;
-        this->totalDuration = animationDuration;
-        //std::cout << "Started moving" << std::endl;
+        // the sessions redo their moves in batches spread over the host's workers
+        std::atomic<bool> consistent{ true };
+        for (int first = 0; first < host.sessions.size(); first += SessionHost::BATCH)
+        {
+            int count = std::min(SessionHost::BATCH, (int)host.sessions.size() - first);
+            host.pool.submit((first / SessionHost::BATCH) % host.pool.size(), [&host, &moves, &consistent, first, count]()
+            {
+                for (int i = first; i < first + count; i++)
+                {
+                    GameSession& session = *host.sessions[i];
+                    for (int m = 0; m < moves[i].size(); m++)
+                    {
+                        if (!session.redo(moves[i][m])) consistent = false;
+                    }
+                    session.played.clear();
+                }
+            });
+        }
+        host.pool.wait();
+
+        this->journaled = host.sessions.size();
+        stats.sessions = host.sessions.size();
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        this->recovered = true;
+        return consistent;
     }
 
-    void undoMove()
+    // opens a new segment after the ones recovered and starts the writer and the compactor
+    bool start()
     {
-        this->destination = this->origin;
-        this->origin = this->position;
-        this->moving = true;
-        this->currentStep = 0.0f;
+        if (!this->recovered || !this->openSegment()) return false;
+        this->writer = std::thread([this]() { this->write(); });
+        this->compactor = std::thread([this]() { this->compact(); });
+        return true;
     }
 
-    void draw(sf::RenderTarget& target, sf::RenderStates states) const
+    // appends the sessions opened and the moves played since the last call, and returns once they are on disk
+    void record(SessionHost& host)
     {
-        //if (this->type == Tile::TileType(0)) return;
-
-        target.draw(this->tileSprite);
-        if (this->selected)
+        std::vector<uint8_t>& out = this->staged;
+        out.clear();
+        int count = 0;
+        for (; this->journaled < host.sessions.size(); this->journaled++)
         {
-            target.draw(this->selectorSprite);
+            GameSession& session = *host.sessions[this->journaled];
+            this->payload.clear();
+            writeVarint(this->payload, session.id);
+            writeVarint(this->payload, JOURNAL_OPEN);
+            writeVarint(this->payload, session.seed);
+            writeVarint(this->payload, session.simulated);
+            this->frame(out);
+            count++;
+        }
+        for (int i = 0; i < host.sessions.size(); i++)
+        {
+            GameSession& session = *host.sessions[i];
+            for (int m = 0; m < session.played.size(); m++)
+            {
+                const PlayedMove& played = session.played[m];
+                this->payload.clear();
+                writeVarint(this->payload, session.id);
+                writeVarint(this->payload, JOURNAL_MOVE);
+                writeVarint(this->payload, ((uint64_t)played.move.from << 2) | swapDirection(session.logic.board.width, played.move));
+                writeVarint(this->payload, played.scoreGained);
+                writeVarint(this->payload, played.picked);
+                this->frame(out);
+                count++;
+            }
         }
+        if (count == 0) return;
+
+        std::unique_lock<std::mutex> lock(this->lock);
+        this->pending.insert(this->pending.end(), out.begin(), out.end());
+        this->appended++;
+        this->records += count;
+        uint64_t wanted = this->appended;
+        this->wake.notify_all();
+        this->durableWake.wait(lock, [this, wanted]() { return this->durable >= wanted || this->failed; });
     }
 
-    sf::Texture* getTextureForTile(Tile::TileType type)
+    // flushes what is pending and waits for the compactor to finish the segments it was given
+    void stop()
     {
-        switch (type)
         {
-        case (Tile::TileType::BLUE):
-            return textures.blueTexture;
-        case (Tile::TileType::GREEN):
-            return textures.greenTexture;
-        case (Tile::TileType::RED):
-            return textures.redTexture;
-        case (Tile::TileType::WILDCARD):
-            return textures.wildcardTexture;
-        case (Tile::TileType::YELLOW):
-            return textures.yellowTexture;
-        case (Tile::TileType::BOMB):
-            return textures.bombTexture;
-        case (Tile::TileType::PURPLE):
-            return textures.purpleTexture;
-        //    return nullptr;
-        default:
-            ;
+            std::lock_guard<std::mutex> lock(this->lock);
+            this->stopping = true;
         }
+        this->wake.notify_all();
+        if (this->writer.joinable()) this->writer.join();
+        if (this->compactor.joinable()) this->compactor.join();
     }
 
-    void select()
+    // the segment being written, for tools that want to damage it on purpose
+    std::string currentSegment() const
     {
-        this->selected = true;
+        return this->segmentPath(this->segment);
     }
 
-    void deselect()
+    // deletes the snapshot and every segment
+    void erase()
     {
-        this->selected = false;
+        uint64_t next = 0;
+        std::ifstream file(this->path + ".snapshot", std::ios::binary);
+        std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        const uint8_t* data = bytes.data() + std::min(bytes.size(), (size_t)5);
+        if (this->sameSettings(data, bytes.data() + bytes.size())) readVarint(data, bytes.data() + bytes.size(), next);
+        file.close();
+        std::remove((this->path + ".snapshot").c_str());
+        std::remove((this->path + ".snapshot.tmp").c_str());
+        for (uint64_t segment = 0; segment < next || std::ifstream(this->segmentPath(segment)).is_open(); segment++)
+        {
+            std::remove(this->segmentPath(segment).c_str());
+        }
     }
 
-    bool isSelected()
+private:
+    enum SegmentRead
     {
-        return this->selected;
-    }
+        SEGMENT_READ,
+        SEGMENT_MISSING,
+        SEGMENT_BAD
+    };
 
-    bool operator==(Tile t)
+    Config config;
+    bool recovered{ false };
+    int journaled{ 0 }; // sessions whose open record is written
+    std::vector<uint8_t> staged;
+    std::vector<uint8_t> payload;
+
+    // writer
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable durableWake;
+    std::vector<uint8_t> pending;
+    uint64_t appended{ 0 }; // batches handed to the writer
+    uint64_t durable{ 0 }; // batches synced
+    bool stopping{ false };
+    bool failed{ false };
+    std::thread writer;
+    AppendFile file;
+    uint64_t segment{ 0 }; // being written
+    size_t segmentSize{ 0 };
+
+    // compactor, segments below folded are in the snapshot and deleted
+    std::thread compactor;
+    uint64_t folded{ 0 };
+
+    std::string segmentPath(uint64_t segment) const
     {
-        return this->type == Tile::TileType::WILDCARD || t.type == Tile::TileType::WILDCARD || this->type == t.type;
+        return this->path + "." + std::to_string(segment);
     }
 
-    bool isEmpty()
+    static int swapDirection(int width, SwapMove move)
     {
-        return this->type == Tile::TileType(0);
+        if (move.to == move.from + width) return REPLAY_SWAP_DOWN;
+        if (move.to == move.from - 1) return REPLAY_SWAP_LEFT;
+        if (move.to == move.from - width) return REPLAY_SWAP_UP;
+        return REPLAY_SWAP_RIGHT;
     }
 
-    void markForDeath()
+    static SwapMove swapFrom(int width, uint64_t packed)
     {
-        //this->selected = true;
-        this->dead = true;
+        const int offsets[] = { 1, width, -1, -width };
+        int from = (int)(packed >> 2);
+        return { from, from + offsets[packed & 3] };
     }
 
-    bool isDead()
+    // what every file starts with, files written with other game settings are not read
+    void header(std::vector<uint8_t>& out, char kind) const
     {
-        return this->dead;
+        const char magic[] = { 'M', '3', 'J', kind };
+        out.insert(out.end(), magic, magic + 4);
+        out.push_back(VERSION);
     }
-};
 
-//============================================================================================
-//                    .: OBSERVERS & EVENTS :.
-//============================================================================================
-
-
-class Scoreboard
-{
-public:
-    int score{ 0 };
-
-    void add(int score)
+    void settings(std::vector<uint8_t>& out) const
     {
-        this->score += score;
-        std::cout << "Current score: " << this->score << std::endl;
+        writeVarint(out, (uint64_t)this->config.gridWidth);
+        writeVarint(out, (uint64_t)this->config.gridHeight);
+        writeVarint(out, this->config.tileTypes);
+        writeVarint(out, this->config.wildcardChance);
+        writeVarint(out, (uint64_t)this->config.powerUpBomb);
     }
-};
-Scoreboard scoreboard;
 
-class MatchEvent: public Event
-{
-public:
-    MatchEvent(Event::EventType type, int payload):
-        Event(type, payload)
+    bool sameSettings(const uint8_t*& data, const uint8_t* end) const
     {
+        std::vector<uint8_t> expected;
+        this->settings(expected);
+        if (end - data < (ptrdiff_t)expected.size() || std::memcmp(data, expected.data(), expected.size()) != 0) return false;
+        data += expected.size();
+        return true;
     }
-};
-
-class Observer
-{
-public:
-    virtual void onNotify(Event* event) = 0;
-};
 
-class Subject
-{
-public:
-    std::vector<Observer*> observers[10];
-    int numObservers{ 0 };
+    // length, payload, checksum of the payload
+    void frame(std::vector<uint8_t>& out) const
+    {
+        writeVarint(out, this->payload.size());
+        out.insert(out.end(), this->payload.begin(), this->payload.end());
+        uint32_t checksum = journalChecksum(this->payload.data(), this->payload.size());
+        for (int b = 0; b < 4; b++) out.push_back((uint8_t)(checksum >> (8 * b)));
+    }
 
-    void addObserver(Observer* obs)
+    bool openSegment()
     {
-        this->observers->push_back(obs);
-        this->numObservers++;
+        std::vector<uint8_t> bytes;
+        this->header(bytes, 'N');
+        writeVarint(bytes, this->segment);
+        this->settings(bytes);
+        if (!this->file.open(this->segmentPath(this->segment)) || !this->file.write(bytes.data(), bytes.size()) || !this->file.sync())
+        {
+            LOG(Error, System, "Could not open journal segment {}", this->segmentPath(this->segment));
+            return false;
+        }
+        this->segmentSize = bytes.size();
+        return true;
     }
 
-    void notify(Event* event)
+    // group commit: everything that piled up while the last batch was syncing goes out in one write and one sync
+    void write()
     {
-        for (int i = 0; i < this->numObservers; i++)
+        std::vector<uint8_t> writing;
+        std::unique_lock<std::mutex> lock(this->lock);
+        while (true)
         {
-            (*this->observers)[i]->onNotify(event);
+            this->wake.wait(lock, [this]() { return this->stopping || !this->pending.empty(); });
+            if (this->pending.empty()) break;
+            writing.swap(this->pending);
+            uint64_t batch = this->appended;
+            lock.unlock();
+
+            bool written = this->file.write(writing.data(), writing.size()) && this->file.sync();
+            this->syncs++;
+            this->segmentSize += writing.size();
+            writing.clear();
+            bool rotate = written && this->segmentSize >= this->segmentBytes;
+            if (rotate)
+            {
+                this->file.close();
+                lock.lock();
+                this->segment++;
+                lock.unlock();
+                written = this->openSegment();
+            }
+
+            lock.lock();
+            if (!written && !this->failed)
+            {
+                LOG(Error, System, "Journal write failed, {} is no longer kept up to date", this->path);
+                this->failed = true;
+            }
+            this->durable = batch;
+            this->durableWake.notify_all();
+            if (rotate) this->wake.notify_all();
         }
+        this->file.close();
     }
-};
-Subject eventWatcher;
 
-class MatchObserver : public Observer
-{
-public:
-    Scoreboard* scoreboard;
-    MatchObserver(Scoreboard& scoreboard)
+    // folds closed segments into the snapshot, one pass per segment closed
+    void compact()
     {
-        this->scoreboard = &scoreboard;
+        std::vector<std::unique_ptr<GameSession>> sessions;
+        std::vector<std::vector<PlayedMove>> moves;
+        std::function<GameSession&(uint64_t, bool)> open = [this, &sessions](uint64_t seed, bool simulated) -> GameSession&
+        {
+            sessions.push_back(std::unique_ptr<GameSession>(new GameSession(sessions.size(), 0, this->config, seed, simulated)));
+            return *sessions.back();
+        };
+
+        uint64_t next;
+        long long ignored = 0;
+        if (!this->readSnapshot(open, moves, next))
+        {
+            LOG(Error, System, "Journal snapshot of {} is damaged, nothing is compacted", this->path);
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(this->lock);
+        while (true)
+        {
+            this->wake.wait(lock, [this, next]() { return this->stopping || next < this->segment; });
+            if (next >= this->segment) break;
+            uint64_t closed = this->segment;
+            lock.unlock();
+
+            bool ok = true;
+            for (; ok && next < closed; next++)
+            {
+                ok = this->readSegment(next, open, moves, ignored) != SEGMENT_BAD;
+            }
+            for (int i = 0; ok && i < sessions.size(); i++)
+            {
+                for (int m = 0; ok && m < moves[i].size(); m++) ok = sessions[i]->redo(moves[i][m]);
+                moves[i].clear();
+                sessions[i]->played.clear();
+            }
+            ok = ok && this->writeSnapshot(sessions, next);
+            if (!ok)
+            {
+                LOG(Error, System, "Journal compaction failed, segments of {} are kept", this->path);
+                return;
+            }
+            for (uint64_t segment = this->folded; segment < next; segment++) std::remove(this->segmentPath(segment).c_str());
+            this->folded = next;
+            this->compactions++;
+            lock.lock();
+        }
     }
 
-    virtual void onNotify(Event* event)
+    // per session: seed, simulated, moves played and the GameSnapshot up to the last cell in use
+    bool writeSnapshot(const std::vector<std::unique_ptr<GameSession>>& sessions, uint64_t next)
     {
-        if (event->type == Event::EventType::EventMatch)
+        std::vector<uint8_t> bytes;
+        this->header(bytes, 'S');
+        this->settings(bytes);
+        writeVarint(bytes, next);
+        writeVarint(bytes, sessions.size());
+        std::unique_ptr<GameSnapshot> snapshot(new GameSnapshot());
+        for (int i = 0; i < sessions.size(); i++)
         {
-            std::cout << "Score event notification" << std::endl;
-            this->scoreboard->add(event->payload);
+            GameSession& session = *sessions[i];
+            if (!snapshot->capture(session.logic, session.config, session.scoreboard.score, 0.0f, session.player)) return false;
+            size_t used = offsetof(GameSnapshot, cells) + session.logic.board.cells.size();
+            writeVarint(bytes, session.seed);
+            writeVarint(bytes, session.simulated);
+            writeVarint(bytes, session.movesPlayed);
+            writeVarint(bytes, used);
+            bytes.insert(bytes.end(), (const uint8_t*)snapshot.get(), (const uint8_t*)snapshot.get() + used);
+        }
+        uint32_t checksum = journalChecksum(bytes.data(), bytes.size());
+        for (int b = 0; b < 4; b++) bytes.push_back((uint8_t)(checksum >> (8 * b)));
+
+        std::string temporary = this->path + ".snapshot.tmp";
+        std::remove(temporary.c_str());
+        AppendFile file;
+        if (!file.open(temporary) || !file.write(bytes.data(), bytes.size()) || !file.sync()) return false;
+        file.close();
+        return replaceFile(temporary, this->path + ".snapshot");
+    }
 
+    // no snapshot is an empty one, next is the first segment it does not hold
+    bool readSnapshot(std::function<GameSession&(uint64_t, bool)>& open, std::vector<std::vector<PlayedMove>>& moves, uint64_t& next)
+    {
+        next = 0;
+        std::ifstream file(this->path + ".snapshot", std::ios::binary);
+        if (!file.is_open()) return true;
+        std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (bytes.size() < 9) return false;
+        const uint8_t* data = bytes.data();
+        const uint8_t* end = data + bytes.size() - 4;
+        uint32_t checksum = 0;
+        for (int b = 0; b < 4; b++) checksum |= (uint32_t)end[b] << (8 * b);
+        if (checksum != journalChecksum(data, end - data)) return false;
+        if (data[0] != 'M' || data[1] != '3' || data[2] != 'J' || data[3] != 'S' || data[4] != VERSION) return false;
+        data += 5;
+        uint64_t count;
+        if (!this->sameSettings(data, end) || !readVarint(data, end, next) || !readVarint(data, end, count)) return false;
+
+        std::unique_ptr<GameSnapshot> snapshot(new GameSnapshot());
+        for (uint64_t i = 0; i < count; i++)
+        {
+            uint64_t seed, simulated, played, used;
+            if (!readVarint(data, end, seed) || !readVarint(data, end, simulated) || !readVarint(data, end, played) || !readVarint(data, end, used)) return false;
+            if (used > sizeof(GameSnapshot) || used > (size_t)(end - data)) return false;
+            std::memset(snapshot.get(), 0, sizeof(GameSnapshot));
+            std::memcpy(snapshot.get(), data, used);
+            data += used;
+            if (!snapshot->valid() || offsetof(GameSnapshot, cells) + snapshot->gridWidth * snapshot->gridHeight != used) return false;
+
+            GameSession& session = open(seed, simulated != 0);
+            if (session.logic.board.width != snapshot->gridWidth || session.logic.board.height != snapshot->gridHeight) return false;
+            snapshot->restore(session.logic, session.player);
+            session.scoreboard.score = snapshot->score;
+            session.movesPlayed = (int)played;
+            if (session.leaderboard) session.leaderboard->report(session.id, session.scoreboard.score);
+            moves.push_back(std::vector<PlayedMove>());
         }
+        return true;
     }
-};
 
-class SoundObserver : public Observer
-{
-public:
-    virtual void onNotify(Event* event)
+    // sessions opened in the segment are opened through open, their moves are added to moves
+    int readSegment(uint64_t segment, std::function<GameSession&(uint64_t, bool)>& open, std::vector<std::vector<PlayedMove>>& moves, long long& count)
     {
-        if (event->type == Event::EventType::EventMatch)
+        std::ifstream file(this->segmentPath(segment), std::ios::binary);
+        if (!file.is_open()) return SEGMENT_MISSING;
+        std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        const uint8_t* data = bytes.data();
+        const uint8_t* end = data + bytes.size();
+        uint64_t number;
+        if (bytes.size() < 5 || data[0] != 'M' || data[1] != '3' || data[2] != 'J' || data[3] != 'N' || data[4] != VERSION) return SEGMENT_BAD;
+        data += 5;
+        if (!readVarint(data, end, number) || number != segment || !this->sameSettings(data, end)) return SEGMENT_BAD;
+
+        while (data < end)
         {
-			std::cout << "Sound event notification" << std::endl;
-            event->payload = SoundLibrary::SoundMapper::SOUND_MATCH;
-			soundLibrary.play(event);
+            uint64_t size;
+            const uint8_t* record = data;
+            if (!readVarint(record, end, size) || size + 4 > (uint64_t)(end - record)) break;
+            uint32_t checksum = 0;
+            for (int b = 0; b < 4; b++) checksum |= (uint32_t)record[size + b] << (8 * b);
+            if (checksum != journalChecksum(record, (size_t)size)) break;
+            data = record + size + 4;
+
+            const uint8_t* fields = record;
+            uint64_t session, op;
+            if (!readVarint(fields, data, session) || !readVarint(fields, data, op)) return SEGMENT_BAD;
+            if (op == JOURNAL_OPEN)
+            {
+                uint64_t seed, simulated;
+                if (session != moves.size() || !readVarint(fields, data, seed) || !readVarint(fields, data, simulated)) return SEGMENT_BAD;
+                open(seed, simulated != 0);
+                moves.push_back(std::vector<PlayedMove>());
+            }
+            else if (op == JOURNAL_MOVE)
+            {
+                uint64_t packed, scoreGained, picked;
+                if (session >= moves.size() || !readVarint(fields, data, packed) || !readVarint(fields, data, scoreGained) || !readVarint(fields, data, picked)) return SEGMENT_BAD;
+                moves[session].push_back({ swapFrom((int)this->config.gridWidth, packed), (int32_t)scoreGained, (int32_t)picked });
+                count++;
+            }
+            else return SEGMENT_BAD;
         }
+        return SEGMENT_READ;
     }
 };
+const uint8_t SessionJournal::VERSION;
 
-//====================================================================================
-//                            .: PARTICLE SYSTEM :.
-//====================================================================================
-
-/*
-* a--b  texture polygon utility for textured particles
-* |  |
-* d--c
-*/
-class Quad
+// headless load test: simulated players on every session, one move each per tick
+int hostSessions(int sessions, int ticks, Config& config)
 {
-public:
-    sf::Vector2f a, b, c, d;
-    Quad() :
-        a{ sf::Vector2f({0.0f,0.0f}) },
-        b{ sf::Vector2f({0.0f,0.0f}) },
-        c{ sf::Vector2f({0.0f, 0.0f}) },
-        d{ sf::Vector2f({0.0f, 0.0f}) }
+    if (config.seed == 0) config.seed = (uint64_t)std::time(nullptr);
+    SessionHost host(config, config.hostThreads);
+    Leaderboard leaderboard(config.leaderboardScoreRange);
+    host.leaderboard = &leaderboard;
+
+    // sessions left by the last run carry on, new ones are opened up to the count asked for
+    bool journaling = !config.journalPath.empty();
+    SessionJournal journal(config.journalPath, config.journalSegmentBytes, config);
+    JournalStats recovered;
+    if (journaling && (!journal.recover(host, recovered) || !journal.start()))
     {
+        std::cout << "Could not recover the sessions in " << config.journalPath << ", move its files away to start over" << std::endl;
+        return 1;
     }
+    if (recovered.sessions > 0) std::cout << recovered.sessions << " sessions recovered from " << config.journalPath << ", " << recovered.moves << " moves redone in " << recovered.seconds << " s" << std::endl;
 
-    Quad(sf::Vector2f a, sf::Vector2f b, sf::Vector2f c, sf::Vector2f d) :
-        a{ a },
-        b{ b },
-        c{ c },
-        d{ d }
-    {};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int opened = std::max(0, sessions - (int)host.sessions.size());
+    for (int i = 0; i < opened; i++) host.open(config.seed + host.sessions.size(), true);
+    std::cout << opened << " sessions opened in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s on " << host.pool.size() << " workers" << std::endl;
 
-    Quad operator=(Quad other)
+    double committing = 0.0;
+    for (int t = 0; t < ticks; t++)
     {
-        this->a = other.a;
-        this->b = other.b;
-        this->c = other.c;
-        this->d = other.d;
-        return *this;
+        host.tick();
+        if (!journaling) continue;
+        start = std::chrono::steady_clock::now();
+        journal.record(host);
+        committing += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
     }
 
-    void setCoords(sf::Vector2f a, sf::Vector2f b, sf::Vector2f c, sf::Vector2f d)
-    {
-        this->a = a;
-        this->b = b;
-        this->c = c;
-        this->d = d;
-    };
+    HostStats stats = host.stats();
+    double movesPerCore = stats.moves / stats.seconds / stats.workers;
+    std::cout << stats.moves << " moves in " << stats.seconds << " s, " << movesPerCore << " moves/s per core, p50 " << stats.p50 << " us, p99 " << stats.p99 << " us, " << stats.steals << " steals" << std::endl;
+    std::cout << (double)stats.sessions / stats.workers << " sessions per core hosted, room for " << movesPerCore * 2.0 << " per core at one move every 2 s" << std::endl;
 
-};
+    std::vector<LeaderboardEntry> best;
+    leaderboard.top(3, best);
+    for (int i = 0; i < best.size(); i++) std::cout << "#" << leaderboard.rank(best[i].player) << " session " << best[i].player << ": " << best[i].score << std::endl;
+    if (!config.leaderboardPath.empty() && !leaderboard.checkpoint(config.leaderboardPath)) std::cout << "Could not write " << config.leaderboardPath << std::endl;
+    if (journaling)
+    {
+        journal.stop();
+        std::cout << journal.records << " journal records in " << journal.syncs << " syncs, " << committing * 1000.0 / std::max(ticks, 1) << " ms per tick committing, "
+            << journal.compactions << " compactions" << std::endl;
+    }
+    return 0;
+}
 
-struct ParticleProperties
+// runs sessions with the journal on, tears the last record the way a crash in the middle of a write
+// would, then recovers them into a second host and checks every session came back as it was
+int checkJournal(int sessions, int ticks, Config& config)
 {
-    sf::Vector2f position;
-    sf::Vector2f velocity;
-    sf::Vector2f acceleration;
-    sf::Color color;
-    float lifetime;
-    Quad textureCoords;
-    sf::Vector2f size;
-    float startingAlpha;
-    float endAlpha;
-};
+    if (config.seed == 0) config.seed = 1;
+    const std::string path = "journal_check.m3j";
+    size_t segmentBytes = 64 * 1024; // small, so segments are folded into the snapshot along the way
+    SessionJournal(path, segmentBytes, config).erase();
+
+    SessionHost host(config, config.hostThreads);
+    SessionJournal journal(path, segmentBytes, config);
+    JournalStats stats;
+    if (!journal.recover(host, stats) || !journal.start())
+    {
+        std::cout << "Could not start the journal" << std::endl;
+        return 1;
+    }
+    for (int i = 0; i < sessions; i++) host.open(config.seed + i, true);
+    double committing = 0.0;
+    for (int t = 0; t < ticks; t++)
+    {
+        host.tick();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        journal.record(host);
+        committing += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    journal.stop();
+    std::cout << journal.records << " records in " << journal.syncs << " syncs, " << committing * 1000.0 / ticks << " ms per tick committing, " << journal.compactions << " compactions" << std::endl;
+
+    // half a record: a length promising more than follows
+    AppendFile torn;
+    const uint8_t half[] = { 40, 7, 1 };
+    bool ok = torn.open(journal.currentSegment()) && torn.write(half, sizeof(half));
+    torn.close();
+
+    SessionHost restored(config, config.hostThreads);
+    SessionJournal again(path, segmentBytes, config);
+    ok = ok && again.recover(restored, stats) && restored.sessions.size() == host.sessions.size();
+    std::cout << stats.sessions << " sessions recovered, " << stats.moves << " moves redone from " << stats.segments << " segments in " << stats.seconds * 1000.0 << " ms" << std::endl;
+    for (int i = 0; ok && i < host.sessions.size(); i++)
+    {
+        GameSession& live = *host.sessions[i];
+        GameSession& back = *restored.sessions[i];
+        ok = live.logic.board.cells == back.logic.board.cells && live.logic.score == back.logic.score && live.scoreboard.score == back.scoreboard.score
+            && live.movesPlayed == back.movesPlayed && std::memcmp(live.player.state, back.player.state, sizeof(live.player.state)) == 0
+            && std::memcmp(live.logic.spawner.random.state, back.logic.spawner.random.state, sizeof(live.player.state)) == 0;
+    }
+    again.erase();
+    std::cout << (ok ? "Every session recovered as it was" : "Recovered sessions DIFFER") << std::endl;
+    return ok ? 0 : 1;
+}
 
-class IUpdatable
-{
-public:
-    void virtual update(float dt) = 0;
-};
+//==========================================================================
+//                     .: BOT SERVER :.
+//==========================================================================
 
-class IDrawable
-{
-public:
-    void virtual draw(sf::VertexArray& va) = 0;
-};
+#ifdef _WIN32
+typedef SOCKET SocketHandle;
+const SocketHandle NO_SOCKET = INVALID_SOCKET;
+#else
+typedef int SocketHandle;
+const SocketHandle NO_SOCKET = -1;
+#endif
 
-class Entity : public IUpdatable
+bool socketsReady()
 {
-public:
-    sf::Vector2f position;
-    sf::Vector2f velocity;
-    sf::Vector2f acceleration;
+#ifdef _WIN32
+    static bool ready = []()
+    {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    return ready;
+#else
+    return true;
+#endif
+}
 
-    Entity(sf::Vector2f position, sf::Vector2f velocity, sf::Vector2f acceleration) :
-        position{ position },
-        velocity{ velocity },
-        acceleration{ acceleration }
-    {};
+void closeSocket(SocketHandle socket)
+{
+    if (socket == NO_SOCKET) return;
+#ifdef _WIN32
+    closesocket(socket);
+#else
+    ::close(socket);
+#endif
+}
 
-    virtual void update(float dt) override
+bool sendAll(SocketHandle socket, const void* data, size_t size)
+{
+    const char* bytes = (const char*)data;
+    while (size > 0)
     {
-        this->velocity += this->acceleration * dt;
-        this->position += this->velocity * dt;
-    };
-};
+#ifdef MSG_NOSIGNAL
+        int sent = (int)::send(socket, bytes, (int)std::min(size, (size_t)1 << 30), MSG_NOSIGNAL);
+#else
+        int sent = (int)::send(socket, bytes, (int)std::min(size, (size_t)1 << 30), 0);
+#endif
+        if (sent <= 0) return false;
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
 
-// ==========
-// Particles
-// ==========
+bool receiveAll(SocketHandle socket, void* data, size_t size)
+{
+    char* bytes = (char*)data;
+    while (size > 0)
+    {
+        int received = (int)::recv(socket, bytes, (int)std::min(size, (size_t)1 << 30), 0);
+        if (received <= 0) return false;
+        bytes += received;
+        size -= received;
+    }
+    return true;
+}
 
-class Particle : public Entity, public IDrawable
+// a stream socket on a path in the file system, AF_UNIX is there on Windows 10 too
+bool unixAddress(const std::string& path, sockaddr_un& address)
 {
-public:
-    float lifetime;
-    float timeElapsed;
-    sf::Color color;
-    Quad textureCoords;
-    bool dead;
-    sf::Vector2f size;
-    float startingAlpha;
-    float endAlpha;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) return false;
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+    return true;
+}
 
-    Particle(ParticleProperties props) :
-        Entity(props.position, props.velocity, props.acceleration),
-        lifetime{ props.lifetime },
-        color{ props.color },
-        textureCoords{ props.textureCoords },
-        size{ props.size },
-        startingAlpha{ props.startingAlpha },
-        endAlpha{ props.endAlpha }
+// a socket file left by a server that did not shut down is replaced
+SocketHandle listenUnix(const std::string& path)
+{
+    sockaddr_un address;
+    if (!socketsReady() || !unixAddress(path, address)) return NO_SOCKET;
+    SocketHandle socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket == NO_SOCKET) return NO_SOCKET;
+    std::remove(path.c_str());
+    if (::bind(socket, (const sockaddr*)&address, sizeof(address)) != 0 || ::listen(socket, 4) != 0)
     {
-        this->dead = false;
-        this->timeElapsed = 0.0f;
+        closeSocket(socket);
+        return NO_SOCKET;
     }
+    return socket;
+}
 
-    void update(float dt)
+SocketHandle connectUnix(const std::string& path)
+{
+    sockaddr_un address;
+    if (!socketsReady() || !unixAddress(path, address)) return NO_SOCKET;
+    SocketHandle socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket == NO_SOCKET) return NO_SOCKET;
+    if (::connect(socket, (const sockaddr*)&address, sizeof(address)) != 0)
     {
-        this->Entity::update(dt);
-        this->timeElapsed += dt;
-        if (this->timeElapsed > this->lifetime)
-        {
-            this->dead = true;
-        }
-        this->color.a = startingAlpha + (startingAlpha - endAlpha > 0 ? -1 : 1) * (abs(startingAlpha - endAlpha)) * (this->timeElapsed / this->lifetime);
+        closeSocket(socket);
+        return NO_SOCKET;
     }
+    return socket;
+}
 
-    void draw(sf::VertexArray& va)
-    {
-        sf::Vertex v;
+// ==========
+// Protocol
+// ==========
 
-        v.color = this->color;
-        v.position = this->position;
-        v.texCoords = this->textureCoords.a;
-        va.append(v);
+// client and server share a machine and a build, so the structs below go over the socket as they are
+// in memory. a request is a BotRequest and count entries of the op's kind, the reply a BotReply and
+// count results. boards never go over the socket: every reset, observe and step writes the board to the
+// next slot of the environment's ring on the shared page, and the result says which slot that was
+enum BotOp : uint32_t
+{
+    BOT_INFO = 0, // no entries, one BotInfo back
+    BOT_RESET = 1, // BotReset entries, BotObservation back
+    BOT_OBSERVE = 2, // BotObserve entries, BotObservation back
+    BOT_STEP = 3, // BotStep entries, BotStepResult back. the environments of one request step in parallel
+    BOT_SHUTDOWN = 4 // the server stops after replying
+};
 
-        v.color = this->color;
-        v.position = this->position + sf::Vector2f({ this->size.x,0 });
-        v.texCoords = this->textureCoords.b;
-        va.append(v);
+enum BotStatus : uint32_t
+{
+    BOT_OK = 0,
+    BOT_BAD_REQUEST = 1, // unknown op or more entries than environments, the connection is closed
+    BOT_BAD_ENVIRONMENT = 2, // out of range, never reset, or twice in one step request
+    BOT_BAD_CONFIG = 3
+};
 
-        v.color = this->color;
-        v.position = this->position + sf::Vector2f({ this->size.x, -this->size.y });
-        v.texCoords = this->textureCoords.c;
-        va.append(v);
+struct BotRequest
+{
+    uint32_t op;
+    uint32_t count;
+};
 
-        v.color = this->color;
-        v.position = this->position + sf::Vector2f({ 0, -this->size.y });
-        v.texCoords = this->textureCoords.d;
-        va.append(v);
-    }
+struct BotReply
+{
+    uint32_t status;
+    uint32_t count;
 };
 
-class PixelFaderParticle : public Particle
+struct BotInfo
 {
-public:
-    PixelFaderParticle(ParticleProperties props) :
-        Particle(props)
-    {}
+    uint32_t environments;
+    uint32_t depth; // ring slots per environment, a slot is reused depth observations later
+    uint32_t maxCells;
+    uint32_t slotBytes;
+};
 
-    void update(float dt)
-    {
-        this->Particle::update(dt);
-        this->color.a = 255 - (this->timeElapsed / this->lifetime) * 255;
-    }
+struct BotReset
+{
+    uint32_t environment;
+    int32_t width;
+    int32_t height;
+    int32_t tileTypes;
+    int32_t wildcardChance;
+    int32_t powerUpBomb;
+    uint64_t seed;
 };
 
-// ==========
-// Emitters
-// ==========
+struct BotObserve
+{
+    uint32_t environment;
+};
 
-class ParticleSystem;
+struct BotStep
+{
+    uint32_t environment;
+    int32_t from;
+    int32_t to;
+};
 
-class IEmitter : public IUpdatable
+struct BotObservation
 {
-public:
-    void virtual init(ParticleSystem& ps) = 0;
-    void virtual update(float dt) = 0;
-    void virtual createParticle(std::vector<Particle*>& v) = 0;
+    uint32_t slot;
+    int32_t score;
+    uint64_t sequence;
+};
 
+// the whole turn the swap set off, down to the settled board
+struct BotStepResult
+{
+    int32_t reward; // score gained
+    int32_t score;
+    uint8_t accepted;
+    uint8_t detonated; // a special was swapped
+    uint8_t reshuffled;
+    uint8_t newBoard; // nothing could be rearranged, the board was replaced
+    uint16_t steps; // cascade steps
+    uint16_t cleared; // tiles cleared
+    uint16_t specials; // special tiles made
+    uint16_t padding;
+    uint32_t slot;
+    uint64_t sequence;
 };
 
-class BaseEmitter : public IEmitter
+// the shared page: this header, then depth slots per environment
+struct BotObservationPage
 {
-public:
-    ParticleSystem* parentPS;
-    bool initialized;
-    sf::Vector2f position;
-    sf::Vector2f acceleration;
-    sf::Vector2f velocity;
-    float lifetime;
-    sf::Color color;
-    Quad textureCoords;
-    sf::Vector2f size;
-    float startingAlpha;
-    float endAlpha;
+    static const uint32_t MAGIC = 0x4f42334d; // "M3BO"
+    static const uint32_t VERSION = 1;
 
-    BaseEmitter(ParticleProperties props) :
-        position{ props.position },
-        velocity{ props.velocity },
-        acceleration{ props.acceleration },
-        lifetime{ props.lifetime },
-        color{ props.color },
-        textureCoords{ props.textureCoords },
-        size{ props.size },
-        startingAlpha{ props.startingAlpha },
-        endAlpha{ props.endAlpha }
+    uint32_t magic;
+    uint32_t version;
+    BotInfo info;
+    uint8_t padding[40]; // slots start on a cache line
+};
+const uint32_t BotObservationPage::MAGIC;
+const uint32_t BotObservationPage::VERSION;
+
+struct BotObservationSlot
+{
+    static const int MAX_CELLS = 256;
+
+    uint64_t sequence; // counts the observations of the environment, tells a stale slot from a fresh one
+    int32_t width;
+    int32_t height;
+    int32_t score;
+    int32_t padding;
+    int8_t cells[MAX_CELLS]; // Tile::TileType per cell, row by row
+};
+const int BotObservationSlot::MAX_CELLS;
+static_assert(sizeof(BotObservationPage) == 64, "slots have to start on a cache line");
+static_assert(sizeof(BotStepResult) == 32, "BotStepResult goes over the socket as it is");
+static_assert(sizeof(BotReset) == 32, "BotReset goes over the socket as it is");
+
+// ==========
+// Server
+// ==========
+
+// the game logic for agents, no window and no audio. one client at a time, the next one is accepted
+// when it leaves. environments keep their state between clients until they are reset
+class BotServer
+{
+public:
+    int capacity;
+    int depth;
+    long long steps{ 0 };
+    double busy{ 0.0 }; // seconds spent stepping, not waiting on the socket
+
+    BotServer(const Config& config) :
+        capacity{ std::max(config.botEnvironments, 1) },
+        depth{ std::max(config.botObservationDepth, 1) },
+        jobs(config.botServerThreads),
+        environments(capacity)
     {
-        this->initialized = false;
-        parentPS = nullptr;
     }
 
-    void init(ParticleSystem& ps)
+    BotServer(const BotServer&) = delete;
+    BotServer& operator=(const BotServer&) = delete;
+
+    ~BotServer()
     {
-        this->parentPS = &ps;
-        this->initialized = true;
+        closeSocket(this->listening);
+        if (!this->socketPath.empty()) std::remove(this->socketPath.c_str());
     }
 
-    void createParticle(std::vector<Particle*>& v)
+    // observations go to <socketPath>.obs, a tmpfs directory keeps them off the disk
+    bool open(const std::string& socketPath)
     {
-        if (this->initialized)
+        size_t bytes = sizeof(BotObservationPage) + (size_t)this->capacity * this->depth * sizeof(BotObservationSlot);
+        if (!this->page.open(socketPath + ".obs", bytes, true)) return false;
+        BotObservationPage* header = (BotObservationPage*)this->page.data;
+        std::memset(header, 0, sizeof(BotObservationPage));
+        header->info = { (uint32_t)this->capacity, (uint32_t)this->depth, (uint32_t)BotObservationSlot::MAX_CELLS, (uint32_t)sizeof(BotObservationSlot) };
+        header->version = BotObservationPage::VERSION;
+        header->magic = BotObservationPage::MAGIC;
+        this->slots = (BotObservationSlot*)(header + 1);
+
+        this->listening = listenUnix(socketPath);
+        if (this->listening == NO_SOCKET) return false;
+        this->socketPath = socketPath;
+        return true;
+    }
+
+    // serves clients until one asks for BOT_SHUTDOWN
+    void run()
+    {
+        while (true)
         {
-            ParticleProperties props;
-            props.position = this->position;
-            props.velocity = this->velocity;
-            props.acceleration = this->acceleration;
-            props.color = this->color;
-            props.lifetime = this->lifetime;
-            props.textureCoords = this->textureCoords;
-            props.size = this->size;
-            props.startingAlpha = this->startingAlpha;
-            props.endAlpha = this->endAlpha;
-            v.push_back(new Particle(props));
+            SocketHandle client = ::accept(this->listening, nullptr, nullptr);
+            if (client == NO_SOCKET) continue;
+            bool keepGoing = this->serve(client);
+            closeSocket(client);
+            if (!keepGoing) return;
         }
     }
 
-    void update(float dt)
+private:
+    struct Environment
+    {
+        Config config;
+        GameLogic logic;
+        CascadeLog cascade;
+        uint64_t sequence{ 0 };
+        uint64_t batch{ 0 }; // last step request it was in
+
+        Environment(const Config& config, uint64_t seed) :
+            config(config),
+            logic(this->config, seed)
+        {
+        }
+    };
+
+    std::string socketPath;
+    SocketHandle listening{ NO_SOCKET };
+    MappedFile page;
+    BotObservationSlot* slots{ nullptr };
+    JobSystem jobs;
+    JobCounter stepped;
+    uint64_t batches{ 0 };
+    std::vector<std::unique_ptr<Environment>> environments;
+
+    // scratch, kept between requests
+    std::vector<BotReset> resets;
+    std::vector<BotObserve> observes;
+    std::vector<BotStep> moves;
+    std::vector<BotObservation> observations;
+    std::vector<BotStepResult> results;
+    std::vector<uint8_t> out;
+
+    // false when the client asked the server to stop
+    bool serve(SocketHandle client)
     {
+        while (true)
+        {
+            BotRequest request;
+            if (!receiveAll(client, &request, sizeof(request))) return true;
+            if (request.count > (uint32_t)this->capacity)
+            {
+                this->reply<BotObservation>(client, BOT_BAD_REQUEST, nullptr, 0);
+                return true;
+            }
+
+            bool done = false;
+            switch (request.op)
+            {
+            case BOT_INFO:
+            {
+                BotInfo info = ((BotObservationPage*)this->page.data)->info;
+                if (!this->reply(client, BOT_OK, &info, 1)) return true;
+                break;
+            }
+            case BOT_RESET:
+                if (!this->receive(client, request.count, this->resets)) return true;
+                if (!this->reset(client)) return true;
+                break;
+            case BOT_OBSERVE:
+                if (!this->receive(client, request.count, this->observes)) return true;
+                if (!this->observe(client)) return true;
+                break;
+            case BOT_STEP:
+                if (!this->receive(client, request.count, this->moves)) return true;
+                if (!this->step(client)) return true;
+                break;
+            case BOT_SHUTDOWN:
+                this->reply<BotObservation>(client, BOT_OK, nullptr, 0);
+                done = true;
+                break;
+            default:
+                this->reply<BotObservation>(client, BOT_BAD_REQUEST, nullptr, 0);
+                return true;
+            }
+            if (done) return false;
+        }
     }
 
-    void updateFromParent(sf::Vector2f position)
+    template <typename Entry>
+    bool receive(SocketHandle client, uint32_t count, std::vector<Entry>& entries)
     {
-        this->position = position;
+        entries.resize(count);
+        return count == 0 || receiveAll(client, entries.data(), count * sizeof(Entry));
     }
-};
 
-class ExplosionEmitter : public BaseEmitter
-{
-public:
-    int particlesNumber;
-    ExplosionEmitter(ParticleProperties props, int particlesNumber) :
-        BaseEmitter(props),
-        particlesNumber{ particlesNumber }
-    {}
+    // header and results in one send
+    template <typename Result>
+    bool reply(SocketHandle client, uint32_t status, const Result* results, uint32_t count)
+    {
+        BotReply header{ status, status == BOT_OK ? count : 0 };
+        this->out.resize(sizeof(header) + header.count * sizeof(Result));
+        std::memcpy(this->out.data(), &header, sizeof(header));
+        if (header.count > 0) std::memcpy(this->out.data() + sizeof(header), results, header.count * sizeof(Result));
+        return sendAll(client, this->out.data(), this->out.size());
+    }
 
-    void createParticle(std::vector<Particle*>& v)
+    bool reset(SocketHandle client)
     {
-        for (int i = 0; i < particlesNumber; i++)
+        for (int i = 0; i < this->resets.size(); i++)
         {
-            sf::Vector2f randomSpeed({ float(std::rand()) / RAND_MAX * 200, 0 });
-            randomSpeed = rotateVector(randomSpeed, i * (360.0f / this->particlesNumber));
+            const BotReset& reset = this->resets[i];
+            if (reset.environment >= (uint32_t)this->capacity) return this->reply<BotObservation>(client, BOT_BAD_ENVIRONMENT, nullptr, 0);
+            if (!playableSettings(reset.width, reset.height, reset.tileTypes, reset.wildcardChance, reset.powerUpBomb, BotObservationSlot::MAX_CELLS)) return this->reply<BotObservation>(client, BOT_BAD_CONFIG, nullptr, 0);
+        }
 
-            ParticleProperties props;
-            props.position = this->position;
-            props.velocity = randomSpeed;
-            props.acceleration = { 0, 0 };
-            props.color = this->color;
-            props.lifetime = this->lifetime;
-            props.textureCoords = this->textureCoords;
-            props.size = this->size;
-            props.startingAlpha = this->startingAlpha;
-            props.endAlpha = this->endAlpha;
-            v.push_back(new Particle(props));
+        this->observations.resize(this->resets.size());
+        for (int i = 0; i < this->resets.size(); i++)
+        {
+            const BotReset& reset = this->resets[i];
+            Config config;
+            config.gridWidth = (float)reset.width;
+            config.gridHeight = (float)reset.height;
+            config.tileTypes = reset.tileTypes;
+            config.wildcardChance = reset.wildcardChance;
+            config.powerUpBomb = (float)reset.powerUpBomb;
+            config.seed = reset.seed;
+            std::unique_ptr<Environment>& environment = this->environments[reset.environment];
+            uint64_t sequence = environment ? environment->sequence : 0;
+            environment.reset(new Environment(config, reset.seed));
+            environment->sequence = sequence;
+            this->observations[i] = this->publish(reset.environment);
         }
+        return this->reply(client, BOT_OK, this->observations.data(), (uint32_t)this->observations.size());
     }
-};
 
-// ==========
-// ParticleSystem
-// ==========
-class ParticleSystem : public sf::Drawable, public Entity
-{
-public:
-    sf::Texture* texture;
-    BaseEmitter* emitter;
-    float timeAccumulator;
-    float particleRate;
-    float particleLifetime;
-    bool active;
-    bool firedParticles;
-    std::vector<Particle*> particles;
-    sf::VertexArray particlesVA;
-    sf::VertexArray triangle;
-    ParticleSystem(ParticleProperties props, BaseEmitter* emitter, float particleRate, sf::Texture* texture) :
-        Entity(props.position, props.velocity, props.acceleration),
-        particleLifetime{ props.lifetime },
-        emitter{ emitter },
-        particleRate{ particleRate },
-        timeAccumulator{ 0.0f },
-        texture{ texture },
-        active{ true },
-        firedParticles{ false }
+    bool observe(SocketHandle client)
     {
-        this->particlesVA.setPrimitiveType(sf::PrimitiveType::Quads);
-        this->triangle.setPrimitiveType(sf::PrimitiveType::Triangles);
+        this->observations.resize(this->observes.size());
+        for (int i = 0; i < this->observes.size(); i++)
+        {
+            uint32_t environment = this->observes[i].environment;
+            if (environment >= (uint32_t)this->capacity || !this->environments[environment]) return this->reply<BotObservation>(client, BOT_BAD_ENVIRONMENT, nullptr, 0);
+            this->observations[i] = this->publish(environment);
+        }
+        return this->reply(client, BOT_OK, this->observations.data(), (uint32_t)this->observations.size());
     }
 
-    ~ParticleSystem()
+    bool step(SocketHandle client)
     {
-        //delete this->emitter;
+        uint64_t batch = ++this->batches;
+        for (int i = 0; i < this->moves.size(); i++)
+        {
+            uint32_t environment = this->moves[i].environment;
+            if (environment >= (uint32_t)this->capacity || !this->environments[environment] || this->environments[environment]->batch == batch)
+            {
+                return this->reply<BotStepResult>(client, BOT_BAD_ENVIRONMENT, nullptr, 0);
+            }
+            this->environments[environment]->batch = batch;
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        this->results.resize(this->moves.size());
+        this->jobs.parallelFor(this->moves.size(), 16, this->stepped, [this](int begin, int end)
+        {
+            for (int i = begin; i < end; i++) this->results[i] = this->play(this->moves[i]);
+        });
+        this->jobs.wait(this->stepped);
+        this->busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        this->steps += this->moves.size();
+        return this->reply(client, BOT_OK, this->results.data(), (uint32_t)this->results.size());
     }
 
-    void update(float dt)
+    BotStepResult play(const BotStep& move)
     {
-        this->Entity::update(dt);
-        this->emitter->updateFromParent(this->position);
-        for (int i = 0; i < this->particles.size(); i++)
+        Environment& environment = *this->environments[move.environment];
+        CascadeLog& cascade = environment.cascade;
+        cascade.clear();
+        BotStepResult result;
+        std::memset(&result, 0, sizeof(result));
+        result.accepted = environment.logic.resolveSwap(move.from, move.to, cascade);
+        if (result.accepted)
         {
-            this->particles[i]->update(dt);
-            if (this->particles[i]->dead)
+            result.reward = cascade.scoreGained();
+            result.detonated = cascade[0].detonated;
+            result.steps = (uint16_t)cascade.size();
+            for (int s = 0; s < cascade.size(); s++)
             {
-                delete this->particles[i];
-                this->particles.erase(this->particles.begin() + i);
-                i--;
+                result.cleared += (uint16_t)cascade[s].cleared.size();
+                result.specials += (uint16_t)cascade[s].upgrades.size();
+                result.reshuffled |= cascade[s].reshuffled;
+                result.newBoard |= cascade[s].reset;
             }
         }
+        result.score = environment.logic.score;
+        BotObservation observation = this->publish(move.environment);
+        result.slot = observation.slot;
+        result.sequence = observation.sequence;
+        return result;
+    }
 
-        this->timeAccumulator += dt;
-        if (!this->firedParticles)
+    // the next ring slot of the environment gets its board
+    BotObservation publish(uint32_t index)
+    {
+        Environment& environment = *this->environments[index];
+        const Board& board = environment.logic.board;
+        uint64_t sequence = ++environment.sequence;
+        uint32_t slot = index * this->depth + (uint32_t)(sequence % this->depth);
+        BotObservationSlot& target = this->slots[slot];
+        target.width = board.width;
+        target.height = board.height;
+        target.score = environment.logic.score;
+        for (int i = 0; i < board.cells.size(); i++) target.cells[i] = (int8_t)board.cells[i];
+        target.sequence = sequence;
+        return { slot, environment.logic.score, sequence };
+    }
+};
+
+// the other end, a trainer's binding does the same: requests over the socket, boards read
+// straight from the shared page, no copy on either side
+class BotClient
+{
+public:
+    BotInfo info;
+
+    BotClient()
+    {
+    }
+
+    BotClient(const BotClient&) = delete;
+    BotClient& operator=(const BotClient&) = delete;
+
+    ~BotClient()
+    {
+        closeSocket(this->socket);
+    }
+
+    bool connect(const std::string& socketPath)
+    {
+        this->socket = connectUnix(socketPath);
+        if (this->socket == NO_SOCKET) return false;
+        std::vector<BotInfo> infos;
+        if (this->call(BOT_INFO, (const int*)nullptr, 0, infos) != BOT_OK || infos.size() != 1) return false;
+        this->info = infos[0];
+        if (!this->page.open(socketPath + ".obs", 0, false) || this->page.size < sizeof(BotObservationPage)) return false;
+        const BotObservationPage* header = (const BotObservationPage*)this->page.data;
+        return header->magic == BotObservationPage::MAGIC && header->version == BotObservationPage::VERSION && header->info.slotBytes == sizeof(BotObservationSlot);
+    }
+
+    const BotObservationSlot& observation(uint32_t slot) const
+    {
+        return ((const BotObservationSlot*)((const BotObservationPage*)this->page.data + 1))[slot];
+    }
+
+    // BOT_OK, a BotStatus from the server, or BOT_BAD_REQUEST when the connection broke
+    template <typename Entry, typename Result>
+    uint32_t call(uint32_t op, const Entry* entries, uint32_t count, std::vector<Result>& results)
+    {
+        BotRequest request{ op, count };
+        this->out.resize(sizeof(request) + count * sizeof(Entry));
+        std::memcpy(this->out.data(), &request, sizeof(request));
+        if (count > 0) std::memcpy(this->out.data() + sizeof(request), entries, count * sizeof(Entry));
+        BotReply reply;
+        if (!sendAll(this->socket, this->out.data(), this->out.size()) || !receiveAll(this->socket, &reply, sizeof(reply))) return BOT_BAD_REQUEST;
+        results.resize(reply.count);
+        if (reply.count > 0 && !receiveAll(this->socket, results.data(), reply.count * sizeof(Result))) return BOT_BAD_REQUEST;
+        return reply.status;
+    }
+
+private:
+    SocketHandle socket{ NO_SOCKET };
+    MappedFile page;
+    std::vector<uint8_t> out;
+};
+
+// a server on a thread and a client stepping every environment once per request, choosing among
+// the legal moves it finds on the shared boards. environment 0 is checked against a local game
+int benchmarkBotServer(int count, int batches, Config& config)
+{
+    const std::string path = "bot_check.sock";
+    count = std::min(count, config.botEnvironments);
+    BotServer server(config);
+    if (!server.open(path))
+    {
+        std::cout << "Could not open " << path << std::endl;
+        return 1;
+    }
+    std::thread serving([&server]() { server.run(); });
+
+    BotClient client;
+    bool ok = client.connect(path);
+    std::vector<BotReset> resets(count);
+    for (int e = 0; e < count; e++) resets[e] = { (uint32_t)e, (int32_t)config.gridWidth, (int32_t)config.gridHeight, config.tileTypes, config.wildcardChance, (int32_t)config.powerUpBomb, (uint64_t)e + 1 };
+    std::vector<BotObservation> observations;
+    ok = ok && client.call(BOT_RESET, resets.data(), count, observations) == BOT_OK;
+
+    Config localConfig = config;
+    localConfig.seed = 1;
+    GameLogic local(localConfig, 1);
+    CascadeLog cascade;
+    Board board((int)config.gridWidth, (int)config.gridHeight);
+    std::vector<SwapMove> legal;
+    std::vector<BotStep> moves(count);
+    std::vector<BotStepResult> results;
+    std::vector<uint32_t> slots(count);
+    for (int e = 0; ok && e < count; e++) slots[e] = observations[e].slot;
+    Random random = Random::forStream(1, STREAM_PLAYERS);
+    long long accepted = 0;
+    double choosing = 0.0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int b = 0; ok && b < batches; b++)
+    {
+        std::chrono::steady_clock::time_point choose = std::chrono::steady_clock::now();
+        for (int e = 0; e < count; e++)
         {
-            this->firedParticles = true;
-            this->emitter->createParticle(this->particles);
+            const BotObservationSlot& seen = client.observation(slots[e]);
+            for (int i = 0; i < board.cells.size(); i++) board.cells[i] = seen.cells[i];
+            legalMoves(board, legal);
+            SwapMove move = legal.empty() ? SwapMove{ 0, 1 } : legal[random.nextInt(legal.size())];
+            moves[e] = { (uint32_t)e, move.from, move.to };
+            if (e == 0) ok = board.cells == local.board.cells;
         }
+        choosing += std::chrono::duration<double>(std::chrono::steady_clock::now() - choose).count();
 
-        if (this->firedParticles && this->particles.size() == 0)
+        ok = ok && client.call(BOT_STEP, moves.data(), count, results) == BOT_OK && results.size() == count;
+        for (int e = 0; ok && e < count; e++)
         {
-            this->markForDeath();
+            slots[e] = results[e].slot;
+            accepted += results[e].accepted;
         }
-
-        this->triangle.clear();
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::Space))
+        if (ok)
         {
-            this->triangle.append({ { this->position.x, this->position.y }, sf::Color::Yellow });
-            this->triangle.append({ { this->position.x + 5, this->position.y - 7 }, sf::Color::Yellow });
-            this->triangle.append({ { this->position.x - 5, this->position.y - 7 }, sf::Color::Yellow });
+            cascade.clear();
+            bool played = local.resolveSwap(moves[0].from, moves[0].to, cascade);
+            ok = played == (results[0].accepted != 0) && cascade.scoreGained() == results[0].reward && local.score == results[0].score;
         }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    long long steps = (long long)count * batches;
+
+    std::vector<BotObservation> none;
+    client.call(BOT_SHUTDOWN, (const int*)nullptr, 0, none);
+    serving.join();
+    std::remove((path + ".obs").c_str());
+
+    std::cout << count << " environments, " << steps << " steps (" << accepted * 100 / std::max(steps, 1LL) << "% accepted) in " << seconds << " s" << std::endl;
+    std::cout << steps / (seconds - choosing) / 1000.0 << " steps/ms through the socket, " << server.steps / server.busy / 1000.0 << " steps/ms stepping on "
+        << std::max(1, config.botServerThreads > 0 ? config.botServerThreads : (int)std::thread::hardware_concurrency()) << " threads, client picking moves took "
+        << choosing * 100.0 / seconds << "% of the time" << std::endl;
+    std::cout << (ok ? "Server agrees with a local game" : "Server DISAGREES with a local game") << std::endl;
+    return ok ? 0 : 1;
+}
 
-        this->particlesVA.clear();
-        for (int i = 0; i < this->particles.size(); i++)
+//==========================================================================
+//                     .: BOARD VIEW :.
+//==========================================================================
+
+sf::Vector2f cellPosition(Config& config, int column, int row)
+{
+    return { config.minx + column * config.tileWidth, config.miny + row * config.tileWidth };
+}
+
+void buildTiles(std::vector<Tile>& grid, Board& board, Config& config)
+{
+    grid.clear();
+    for (int row = 0; row < board.height; row++)
+    {
+        for (int column = 0; column < board.width; column++)
         {
-            this->particles[i]->draw(this->particlesVA);
+            if (board.at(column, row) == Board::EMPTY) continue;
+            Tile tile(Tile::TileType(board.at(column, row)), cellPosition(config, column, row), { config.tileWidth, config.tileWidth });
+            tile.cell = board.index(column, row);
+            grid.push_back(tile);
         }
     }
+}
 
-    virtual void draw(sf::RenderTarget& target, sf::RenderStates states) const override
+int tileAtCell(std::vector<Tile>& grid, int cell)
+{
+    for (int i = 0; i < grid.size(); i++)
     {
-        target.draw(this->triangle);
-        target.draw(this->particlesVA, this->texture);
+        if (grid[i].cell == cell && !grid[i].isDead()) return i;
     }
-    
-    void markForDeath()
+    return -1;
+}
+
+// cleared tiles are marked dead for the cleanup pass in main, moved and spawned tiles start falling
+void applyCascadeStep(std::vector<Tile>& grid, Board& board, CascadeStep& step, Config& config)
+{
+    std::vector<int> cellTile(board.cells.size(), -1);
+    for (int i = 0; i < grid.size(); i++)
     {
-        this->active = false;
+        if (!grid[i].isDead() && grid[i].cell >= 0) cellTile[grid[i].cell] = i;
     }
 
-    bool isDead()
+    for (int c = 0; c < step.cleared.size(); c++)
     {
-        return !this->active;
+        int i = cellTile[step.cleared[c]];
+        if (i >= 0) grid[i].markForDeath();
     }
-};
 
-//====================================================================================
-//                           .: UTILITY FUNCTIONS :.
-//====================================================================================
+    for (int u = 0; u < step.upgrades.size(); u++)
+    {
+        int cell = step.upgrades[u].cell;
+        Tile tile(Tile::TileType(step.upgrades[u].type), cellPosition(config, cell % board.width, cell / board.width), { config.tileWidth, config.tileWidth });
+        tile.cell = cell;
+        grid.push_back(tile);
+    }
 
-sf::VertexArray createVertexArray(std::vector<sf::Vector2f> v, sf::Color color)
-{
-    sf::VertexArray va;
-    va.setPrimitiveType(sf::PrimitiveType::LinesStrip);
-    for (int i = 0; i < v.size(); i++)
+    for (int m = 0; m < step.shuffles.size(); m++)
     {
-        va.append(sf::Vertex(v[i], color));
+        int i = cellTile[step.shuffles[m].from];
+        if (i < 0) continue;
+        grid[i].cell = step.shuffles[m].to;
+        grid[i].move(cellPosition(config, step.shuffles[m].to % board.width, step.shuffles[m].to / board.width), 3 * config.swapDuration);
+    }
+
+    for (int m = 0; m < step.moves.size(); m++)
+    {
+        int i = cellTile[board.index(step.moves[m].column, step.moves[m].fromRow)];
+        if (i < 0) continue;
+        grid[i].cell = board.index(step.moves[m].column, step.moves[m].toRow);
+        grid[i].move(cellPosition(config, step.moves[m].column, step.moves[m].toRow), config.swapDuration);
+    }
+
+    if (step.spawns.size() > 0) LOG(Debug, Logic, "Needed tiles: {}", step.spawns.size());
+    for (int l = 0; l < step.spawns.size(); l++)
+    {
+        const TileSpawn& spawn = step.spawns[l];
+        float drop = -spawn.spawnRow;
+        float needed = spawn.row - spawn.spawnRow;
+        Tile tile(Tile::TileType(spawn.type), cellPosition(config, spawn.column, spawn.spawnRow), sf::Vector2f({ config.tileWidth, config.tileWidth }));
+        tile.cell = board.index(spawn.column, spawn.row);
+        tile.move(cellPosition(config, spawn.column, spawn.row), (1 + 2 * spawn.column / config.gridWidth + drop / needed) * config.swapDuration);
+        grid.push_back(tile);
     }
-    return va;
 }
 
-sf::Vector2f normalize(sf::Vector2f v)
+// turbo mode: the whole cascade already happened, score it and put the tiles straight where they ended up
+void applyCascadeInstantly(std::vector<Tile>& grid, GameLogic& logic, CascadeLog& log, Config& config)
 {
-    return v / std::sqrt(v.x * v.x + v.y * v.y);
+    for (int i = 0; i < log.size(); i++)
+    {
+        if (log[i].scoreGained > 0)
+        {
+            eventWatcher.notify(new Event(Event::EventType::EventMatch, log[i].scoreGained));
+        }
+    }
+    buildTiles(grid, logic.board, config);
 }
 
-float distanceBetweenPoints(sf::Vector2f A, sf::Vector2f B)
+// what the render loop reads, sampled fresh every frame
+struct InputState
 {
-    return std::sqrt((B.x - A.x) * (B.x - A.x) + (B.y - A.y) * (B.y - A.y));
-}
+    sf::Vector2f mouse;
+    bool left{ false };
+    bool right{ false };
+    bool space{ false };
+    uint32_t turboPresses{ 0 }; // counted, so a press between two ticks is not lost
+    bool quit{ false };
+};
 
-void fillNewGrid(std::vector<Tile>& grid, Config& config)
+// everything the render loop needs of one simulation tick, copied out so the simulation can go on.
+// the vectors keep their capacity, so once warmed up capturing a tick allocates nothing
+struct RenderSnapshot : public sf::Drawable
 {
-    grid.clear();
-    for (int j = 0; j < config.gridHeight; j++)
+    // particles of systems sharing a texture go out in one draw
+    struct ParticleBatch
     {
-        for (int i = 0; i < config.gridWidth; i++)
-        {
-            //std::cout << "Working on [" << j + 1 << ", " << i + 1 << "] index: "<<i + j * config.gridWidth<<std::endl;
-            std::vector<int> possibleTypes;
-            for (int k = 0; k < config.tileTypes; k++) possibleTypes.push_back(k);
-            possibleTypes.erase(possibleTypes.end() - 1); // remove bomb tile
-            possibleTypes.erase(possibleTypes.end() - 1); // remove wildcard tile
+        const sf::Texture* texture;
+        int first;
+        int count;
+    };
 
-            if (i > 1)
-            {
-                if (grid[i - 1 + j * config.gridWidth] == grid[i - 2 + j * config.gridWidth])
-                {
-                    for (int k = 0; k < possibleTypes.size(); k++)
-                    {
-                        if (grid[i - 1 + j * config.gridWidth].type == Tile::TileType(possibleTypes[k]))
-                        {
-                            //std::cout << "Eliminated tile: " << tileTypeToColor[possibleTypes[k]] << std::endl;
-                            possibleTypes.erase(possibleTypes.begin() + k);
-                            break;
-                        }
-                    }
-                }
-            }
+    std::vector<Tile> tiles;
+    std::vector<sf::Vertex> particles;
+    std::vector<ParticleBatch> batches;
+    std::vector<sf::Vertex> markers;
+    int score{ 0 };
 
-            if (j > 1)
+    void capture(const std::vector<Tile>& grid, const std::vector<ParticleSystem*>& systems, int score)
+    {
+        this->tiles.assign(grid.begin(), grid.end());
+        this->particles.clear();
+        this->batches.clear();
+        this->markers.clear();
+        for (int i = 0; i < systems.size(); i++)
+        {
+            const ParticleSystem& system = *systems[i];
+            int count = system.particlesVA.getVertexCount();
+            if (count > 0)
             {
-                if (grid[i + (j - 1) * config.gridWidth] == grid[i + (j - 2) * config.gridWidth])
+                if (this->batches.empty() || this->batches.back().texture != system.texture)
                 {
-                    for (int k = 0; k < possibleTypes.size(); k++)
-                    {
-                        if (grid[i + (j - 1) * config.gridWidth].type == Tile::TileType(possibleTypes[k]))
-                        {
-                            //std::cout << "Eliminated tile: " << tileTypeToColor[possibleTypes[k]] << std::endl;
-                            possibleTypes.erase(possibleTypes.begin() + k);
-                            break;
-                        }
-                    }
+                    this->batches.push_back({ system.texture, (int)this->particles.size(), 0 });
                 }
+                this->particles.insert(this->particles.end(), &system.particlesVA[0], &system.particlesVA[0] + count);
+                this->batches.back().count += count;
             }
-
-            //std::cout << "possible : " << possibleTypes.size() << std::endl;
-            int selector = rand() % possibleTypes.size();
-            Tile::TileType t = Tile::TileType(possibleTypes[selector]);
-            Tile tile = Tile(t, sf::Vector2f({ config.minx + config.tileWidth * i, config.miny + config.tileWidth * j }), { config.tileWidth, config.tileWidth });
-            grid.push_back(tile);
-            //std::cout << " type: " << tileTypeToColor[(int)grid[i + j * config.gridWidth].type] << std::endl;
+            for (int v = 0; v < system.triangle.getVertexCount(); v++) this->markers.push_back(system.triangle[v]);
         }
+        this->score = score;
     }
-}
-
-bool matchPossible(std::vector<Tile>& grid, Config& config)
-{
-    float minx{ config.minx };
-    float miny{ config.miny };
-    float maxx{ config.minx + config.tileWidth * config.gridWidth };
-    float maxy{ config.miny + config.tileWidth * config.gridHeight };
 
-    // checking grid positions is inefficient without an actual grid
-    for (int i = 0; i < grid.size(); i++)
+    virtual void draw(sf::RenderTarget& target, sf::RenderStates states) const
     {
-        for (int j = 0; j < grid.size(); j++)
+        for (int i = 0; i < this->tiles.size(); i++)
         {
-            // 4 tests to check 12 possible matches
-            // check possible matches annex
+            target.draw(this->tiles[i], states);
+        }
+        if (!this->markers.empty()) target.draw(&this->markers[0], this->markers.size(), sf::PrimitiveType::Triangles, states);
+        for (int b = 0; b < this->batches.size(); b++)
+        {
+            states.texture = this->batches[b].texture;
+            target.draw(&this->particles[this->batches[b].first], this->batches[b].count, sf::PrimitiveType::Quads, states);
+        }
+    }
+};
 
-            // grid[i+1][j+1] == grid[i][j] => 1 4 8 9 - 4 further tests
-            if (
-                i != j
-                && grid[i] == grid[j]
-                && std::fabs(grid[i].position.x + config.tileWidth - grid[j].position.x) <= 1.0f
-                && std::fabs(grid[i].position.y + config.tileWidth - grid[j].position.y) <= 1.0f
-                )
-            {
-                for (int k = 0; k < grid.size(); k++)
-                {
-                    if (
-                        k != i
-                        && grid[i] == grid[k]
-                        )
-                    {
-                        if ( // 1
-                            std::fabs(grid[i].position.x - config.tileWidth - grid[k].position.x) <= 1.0f
-                            && std::fabs(grid[i].position.y + config.tileWidth - grid[k].position.y) <= 1.0f
-                            )
-                        {
-                            return true;
-                        }
+//==========================================================================
+//                     .: HUD :.
+//==========================================================================
+
+// retained text: every label owns a fixed run of glyph quads in the vertex buffer of its font page
+// and only lays them out again when its text changes. one draw per page, a quiet frame rebuilds nothing
+class Hud : public sf::Drawable
+{
+public:
+    // capacity is the longest text the label will ever show
+    int addLabel(const sf::Font& font, unsigned size, bool bold, sf::Color color, sf::Vector2f position, int capacity)
+    {
+        Label label;
+        label.page = this->pageFor(font, size);
+        label.bold = bold;
+        label.color = color;
+        label.position = position;
+        label.first = (int)this->pages[label.page].vertices.size();
+        label.capacity = capacity;
+        label.text.reserve(capacity);
+        this->pages[label.page].vertices.resize(label.first + capacity * 4, sf::Vertex(position, sf::Color::Transparent));
+        this->labels.push_back(label);
+        return (int)this->labels.size() - 1;
+    }
 
-                        if ( // 4
-                            std::fabs(grid[i].position.x - config.tileWidth - grid[k].position.x) <= 1.0f
-                            && std::fabs(grid[i].position.y - grid[k].position.y) <= 1.0f
-                            )
-                        {
-                            return true;
-                        }
+    void setText(int id, const char* text)
+    {
+        Label& label = this->labels[id];
+        if (label.text == text) return;
+        size_t length = std::strlen(text);
+        label.text.assign(text, length < (size_t)label.capacity ? length : label.capacity);
+        this->layout(label);
+    }
 
-                        if ( // 8
-                            std::fabs(grid[i].position.x + config.tileWidth - grid[k].position.x) <= 1.0f
-                            && std::fabs(grid[i].position.y - config.tileWidth - grid[k].position.y) <= 1.0f
-                            )
-                        {
-                            return true;
-                        }
+    virtual void draw(sf::RenderTarget& target, sf::RenderStates states) const
+    {
+        for (int p = 0; p < this->pages.size(); p++)
+        {
+            const Page& page = this->pages[p];
+            if (page.vertices.empty()) continue;
+            states.texture = &page.font->getTexture(page.size);
+            target.draw(&page.vertices[0], page.vertices.size(), sf::PrimitiveType::Quads, states);
+        }
+    }
 
-                        if ( // 9
-                            std::fabs(grid[i].position.x - grid[k].position.x) <= 1.0f
-                            && std::fabs(grid[i].position.y - config.tileWidth - grid[k].position.y) <= 1.0f
-                            )
-                        {
-                            return true;
-                        }
-                    }
-                }
-            }
+private:
+    // glyphs of one font and size share a texture, so they can go out together
+    struct Page
+    {
+        const sf::Font* font;
+        unsigned size;
+        std::vector<sf::Vertex> vertices;
+    };
 
-            // grid[i+1][j-1] == grid[i][j] => 2 3 7 19 - 4 further tests
-            if (
-                i != j
-                && grid[i] == grid[j]
-                && std::fabs(grid[i].position.x - config.tileWidth - grid[j].position.x) <= 1.0f
-                && std::fabs(grid[i].position.y + config.tileWidth - grid[j].position.y) <= 1.0f
-                )
-            {
-                for (int k = 0; k < grid.size(); k++)
-                {
-                    if (i != k && grid[i] == grid[k])
-                    {
-                        if ( // 2
-                            std::fabs(grid[i].position.x - 2 * config.tileWidth - grid[k].position.x) <= 1.0f
-                            && std::fabs(grid[i].position.y - grid[k].position.y) <= 1.0f
-                            )
-                        {
-                            return true;
-                        }
+    struct Label
+    {
+        int page;
+        bool bold;
+        sf::Color color;
+        sf::Vector2f position;
+        int first; // first vertex of the run
+        int capacity; // in glyphs
+        std::string text;
+    };
 
-                        if ( // 3
-                            std::fabs(grid[i].position.x - 2 * config.tileWidth - grid[k].position.x) <= 1.0f
-                            && std::fabs(grid[i].position.y + config.tileWidth - grid[k].position.y) <= 1.0f
-                            )
-                        {
-                            return true;
-                        }
+    std::vector<Page> pages;
+    std::vector<Label> labels;
 
-                        if ( // 7
-                            std::fabs(grid[i].position.x - config.tileWidth - grid[k].position.x) <= 1.0f
-                            && std::fabs(grid[i].position.y - config.tileWidth - grid[k].position.y) <= 1.0f
-                            )
-                        {
-                            return true;
-                        }
+    int pageFor(const sf::Font& font, unsigned size)
+    {
+        for (int p = 0; p < this->pages.size(); p++)
+        {
+            if (this->pages[p].font == &font && this->pages[p].size == size) return p;
+        }
+        this->pages.push_back({ &font, size, {} });
+        return (int)this->pages.size() - 1;
+    }
 
-                        if ( // 10
-                            std::fabs(grid[i].position.x - grid[k].position.x) <= 1.0f
-                            && std::fabs(grid[i].position.y - config.tileWidth - grid[k].position.y) <= 1.0f
-                            )
-                        {
-                            return true;
-                        }
-                    }
-                }
+    // placed the way sf::Text places glyphs: baseline one character size down, kerning between pairs
+    void layout(const Label& label)
+    {
+        Page& page = this->pages[label.page];
+        sf::Vertex* quad = &page.vertices[label.first];
+        const float padding = 1.0f;
+        float x = 0.0f;
+        float y = (float)page.size;
+        sf::Uint32 previous = 0;
+        int written = 0;
+        for (int i = 0; i < label.text.size(); i++)
+        {
+            sf::Uint32 character = (unsigned char)label.text[i];
+            if (character == '\n')
+            {
+                x = 0.0f;
+                y += page.font->getLineSpacing(page.size);
+                previous = 0;
+                continue;
             }
+            x += page.font->getKerning(previous, character, page.size);
+            previous = character;
+
+            const sf::Glyph& glyph = page.font->getGlyph(character, page.size, label.bold);
+            float left = label.position.x + x + glyph.bounds.left - padding;
+            float top = label.position.y + y + glyph.bounds.top - padding;
+            float right = label.position.x + x + glyph.bounds.left + glyph.bounds.width + padding;
+            float bottom = label.position.y + y + glyph.bounds.top + glyph.bounds.height + padding;
+            float u1 = glyph.textureRect.left - padding;
+            float v1 = glyph.textureRect.top - padding;
+            float u2 = glyph.textureRect.left + glyph.textureRect.width + padding;
+            float v2 = glyph.textureRect.top + glyph.textureRect.height + padding;
+            quad[0] = sf::Vertex({ left, top }, label.color, { u1, v1 });
+            quad[1] = sf::Vertex({ right, top }, label.color, { u2, v1 });
+            quad[2] = sf::Vertex({ right, bottom }, label.color, { u2, v2 });
+            quad[3] = sf::Vertex({ left, bottom }, label.color, { u1, v2 });
+            quad += 4;
+            x += glyph.advance;
+            written++;
+        }
+        // the rest of the run collapses to nothing
+        for (; written < label.capacity; written++, quad += 4)
+        {
+            for (int v = 0; v < 4; v++) quad[v] = sf::Vertex(label.position, sf::Color::Transparent);
+        }
+    }
+};
 
-            // grid[i][j+1] == grid[i][j] => 5 6 - 2 further tests
-            if (
-                i != j
-                && grid[i] == grid[j]
-                && std::fabs(grid[i].position.x + config.tileWidth - grid[j].position.x) <= 1.0f
-                && std::fabs(grid[i].position.y - grid[j].position.y) <= 1.0f
-                )
-            {
-                for (int k = 0; k < grid.size(); k++)
-                {
-                    if (i != k && grid[i] == grid[k])
-                    {
-                        if ( // 5
-                            std::fabs(grid[i].position.x + 3 * config.tileWidth - grid[k].position.x) <= 1.0f
-                            && std::fabs(grid[i].position.y - grid[k].position.y) <= 1.0f
-                            )
-                        {
-                            return true;
-                        }
+// a number that rolls towards its value instead of jumping; the digits are only laid out
+// again when the shown number changes, and they are formatted on the stack
+class HudCounter
+{
+public:
+    Hud* hud;
+    int label;
+    float rollTime; // seconds to catch up with a jump, however big
+    int target{ 0 };
+    float rolling{ 0.0f };
+    int shown{ -1 };
+
+    HudCounter(Hud& hud, int label, float rollTime) :
+        hud{ &hud },
+        label{ label },
+        rollTime{ rollTime }
+    {
+    }
 
-                        if ( // 6
-                            std::fabs(grid[i].position.x - 2 * config.tileWidth - grid[k].position.x) <= 1.0f
-                            && std::fabs(grid[i].position.y - grid[k].position.y) <= 1.0f
-                            )
-                        {
-                            return true;
-                        }
-                    }
-                }
-            }
+    void set(int value)
+    {
+        this->target = value;
+    }
 
-            // grid[i+1][j] == grid[i][j] => 11 12 - 2 further tests
-            if (
-                i != j
-                && grid[i] == grid[j]
-                && std::fabs(grid[i].position.x - grid[j].position.x) <= 1.0f
-                && std::fabs(grid[i].position.y + config.tileWidth - grid[j].position.y) <= 1.0f
-                )
-            {
-                for (int k = 0; k < grid.size(); k++)
-                {
-                    if (i != k && grid[i] == grid[k])
-                    {
-                        if ( // 11
-                            std::fabs(grid[i].position.x - grid[k].position.x) <= 1.0f
-                            && std::fabs(grid[i].position.y - 2 * config.tileWidth - grid[k].position.y) <= 1.0f
-                            )
-                        {
-                            return true;
-                        }
+    // skips the roll, e.g. for a resumed game
+    void jump(int value)
+    {
+        this->target = value;
+        this->rolling = (float)value;
+        this->refresh();
+    }
 
-                        if ( // 12
-                            std::fabs(grid[i].position.x - grid[k].position.x) <= 1.0f
-                            && std::fabs(grid[i].position.y + 3 * config.tileWidth - grid[k].position.y) <= 1.0f
-                            )
-                        {
-                            return true;
-                        }
-                    }
-                }
-            }
+    void update(float dt)
+    {
+        float left = this->target - this->rolling;
+        if (left != 0.0f)
+        {
+            float speed = std::abs(left) / this->rollTime;
+            if (speed < 100.0f) speed = 100.0f;
+            float step = speed * dt;
+            this->rolling = std::abs(left) <= step ? (float)this->target : this->rolling + (left > 0 ? step : -step);
         }
+        this->refresh();
     }
-    return false;
-}
+
+private:
+    void refresh()
+    {
+        int value = (int)this->rolling;
+        if (value == this->shown) return;
+        this->shown = value;
+        char digits[16];
+        std::snprintf(digits, sizeof(digits), "%d", value);
+        this->hud->setText(this->label, digits);
+    }
+};
 
 //==========================================================================
 //                     .: MAIN :.
 //============================================================================
 
 
-int main()
+int main(int argc, char** argv)
 {
+    FrameArena::heapOnly = !config.frameArena;
+
+    // headless tools, no window or audio
+    if (argc > 1 && std::string(argv[1]) == "--verify")
+    {
+        return verifyReplays(argc - 2, argv + 2);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--host")
+    {
+        if (argc > 4) config.seed = std::strtoull(argv[4], nullptr, 10);
+        return hostSessions(argc > 2 ? std::atoi(argv[2]) : config.hostSessions, argc > 3 ? std::atoi(argv[3]) : 20, config);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--validate")
+    {
+        if (argc > 3) config.seed = std::strtoull(argv[3], nullptr, 10);
+        return benchmarkValidation(argc > 2 ? std::atoi(argv[2]) : 1000000, config);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--journal")
+    {
+        return checkJournal(argc > 2 ? std::atoi(argv[2]) : 2000, argc > 3 ? std::atoi(argv[3]) : 50, config);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--serve")
+    {
+        BotServer server(config);
+        std::string path = argc > 2 ? argv[2] : config.botSocketPath;
+        if (!server.open(path))
+        {
+            std::cout << "Could not listen on " << path << std::endl;
+            return 1;
+        }
+        std::cout << "Serving " << server.capacity << " environments on " << path << std::endl;
+        server.run();
+        std::remove((path + ".obs").c_str());
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--botbench")
+    {
+        return benchmarkBotServer(argc > 2 ? std::atoi(argv[2]) : 1024, argc > 3 ? std::atoi(argv[3]) : 200, config);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--leaderboard")
+    {
+        return benchmarkLeaderboard(argc > 2 ? std::atoi(argv[2]) : 1000000, argc > 3 ? std::atoi(argv[3]) : 10000000, config);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--monitor")
+    {
+        return monitorTelemetry(argc > 2 ? argv[2] : config.telemetryPath);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--alloccheck")
+    {
+        if (argc > 2) config.seed = std::strtoull(argv[2], nullptr, 10);
+        return checkAllocations(config);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--math")
+    {
+        return checkMath();
+    }
+    if (argc > 1 && std::string(argv[1]) == "--benchmark")
+    {
+        int kernels = benchmarkKernels();
+        bool shapes = checkShapePriority();
+        bool gravity = benchmarkGravity(config);
+        std::cout << (shapes ? "Shapes are found in rule order" : "Shapes are NOT found in rule order") << std::endl;
+        int arena = benchmarkArena(config);
+        if (kernels != 0) return kernels;
+        return shapes && gravity ? arena : 1;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--autoplay")
+    {
+        if (argc > 3) config.seed = std::strtoull(argv[3], nullptr, 10);
+        return autoPlay(argc > 2 ? std::atoi(argv[2]) : 50, config);
+    }
+
+    // blocks from static initialisers are not counted, they mostly live until exit
+    heapCounter.enabled = !config.telemetryPath.empty();
+
     sf::RenderWindow window(sf::VideoMode(config.gameWidth, config.gameHeight), "SFML works!");
+    window.setVerticalSyncEnabled(config.verticalSync);
 
     // =========================
     // pre game initialization
     // =========================
 
-    std::srand(std::time(nullptr));
+    // pick up where the last session left off, the mapped snapshot is used in place
+    MappedFile savedGame;
+    const GameSnapshot* resumeFrom = nullptr;
+    if (config.resumeGame && savedGame.open(config.snapshotPath, 0, false) && savedGame.size >= sizeof(GameSnapshot))
+    {
+        resumeFrom = (const GameSnapshot*)savedGame.data;
+        if (resumeFrom->valid()) resumeFrom->applyConfig(config);
+        else resumeFrom = nullptr;
+    }
+
+    if (config.seed == 0) config.seed = (uint64_t)std::time(nullptr);
+    logger.setLevel(config.logging ? LogLevel::Debug : LogLevel::Info);
+    logger.run();
+    LOG(Info, System, "Seed: {}", config.seed);
     textures.loadTextures();
     soundLibrary.loadSounds();
     gameAssets.loadSprites();
@@ -1085,375 +7853,370 @@ int main()
     eventWatcher.addObserver(new MatchObserver(scoreboard));
     eventWatcher.addObserver(new SoundObserver());
 
-    sf::Vector2i mousePos;
-    sf::Vector2f mousePosWorld;
-
     sf::Clock frameClock;
-    float dt;
 
     std::vector<Tile> grid; // 10 x 10
     Tile cornerCheck = Tile(Tile::TileType::RED, sf::Vector2f({ config.minx - config.tileWidth, config.miny - config.tileWidth}), { config.tileWidth, config.tileWidth });
     int selectedTileIndex{ -1 };
-    int swappedFromTileIndex{ -1 };
-    int swappedToTileIndex{ -1 };
+    int swappedFromCell{ -1 };
+    int swappedToCell{ -1 };
     float lockInput{ 0.0f };
     float coyoteTime{ 0.0f };
     bool stuffMoving{ false };
-    bool swapMatchCheck{ false };
-    bool collapseNeeded{ false };
-    bool gridResetRequired{ false };
-    int matchedTileCount{ 0 };
-    int powerUpTracker{ 0 };
-    bool bombActive{ false };
 
-    float createdTiles{ 0.0f };
-    float createdWildcardTiles{ 0.0f };
+    BoardPregenerator boardPregenerator(config.pregeneratedBoards);
+    GameLogic logic(config, config.seed, &boardPregenerator);
+    LOG(Info, System, "Board kernels: {} {}x{}", logic.board.kernels ? "fixed" : "generic", logic.board.width, logic.board.height);
+    ReplayRecorder recorder(config);
+    Random effectsRandom = Random::forStream(config.seed, STREAM_EFFECTS);
+    CascadeStep step;
+    CascadeLog cascade;
+    step.reserve(logic.board.cells.size());
+    cascade.reserve(CascadeLog::DEPTH, logic.board.cells.size());
+
+    if (resumeFrom)
+    {
+        resumeFrom->restore(logic, effectsRandom);
+        scoreboard.score = resumeFrom->score;
+        coyoteTime = resumeFrom->coyoteTime;
+        config.recordReplay = false; // a replay has to start from the seed
+        LOG(Info, System, "Resumed saved game, score {}", scoreboard.score);
+    }
+    savedGame.close();
+
+    MappedFile autosave;
+    GameSnapshot* autosaveSlot = nullptr;
+    if (config.resumeGame && autosave.open(config.snapshotPath, sizeof(GameSnapshot), true))
+    {
+        autosaveSlot = (GameSnapshot*)autosave.data;
+    }
 
-    sf::Text scoreText;
-    scoreText.setFont(*fontsLibrary.defaultFont);
-    scoreText.setCharacterSize(24);
-    scoreText.setFillColor(sf::Color::Black);
-    scoreText.setStyle(sf::Text::Bold);
-    scoreText.setPosition(gameAssets.scoreSprite.getPosition());
-
-    sf::Text helpText;
-    helpText.setFont(*fontsLibrary.defaultFont);
-	helpText.setCharacterSize(12);
-	helpText.setFillColor(sf::Color::White);
-	//helpText.setStyle(sf::Text::Bold);
-    helpText.setPosition({ 575, 525 });
-    helpText.setString("Click to match tiles\nGrey tile is wildcard\nBomb tile will destroy\nall adjacent tiles");
+    Telemetry telemetry;
+    TelemetryExport telemetryExport;
+    logic.telemetry = &telemetry;
+    if (!config.telemetryPath.empty() && !telemetryExport.open(config.telemetryPath))
+    {
+        LOG(Warning, System, "Could not map telemetry page {}", config.telemetryPath);
+    }
+
+    Hud hud;
+    const char* helpText = "Click to match tiles\nGrey tile is wildcard\nBomb tile will destroy\nall adjacent tiles\nT toggles turbo mode";
+    int helpLabel = hud.addLabel(*fontsLibrary.defaultFont, 12, false, sf::Color::White, { 575, 525 }, (int)std::strlen(helpText));
+    hud.setText(helpLabel, helpText);
+    HudCounter scoreCounter(hud, hud.addLabel(*fontsLibrary.defaultFont, 24, true, sf::Color::Black, gameAssets.scoreSprite.getPosition(), 11), 0.5f);
+    scoreCounter.jump(scoreboard.score);
 
     std::vector<ParticleSystem*> explosions;
 
+    JobSystem jobs(config.jobThreads);
+    JobCounter tilesUpdated;
+    JobCounter particlesUpdated;
+
     // ======================
     // -= initialization =-
     // ======================
-    fillNewGrid(grid, config);
+    buildTiles(grid, logic.board, config);
 
     // ======================
     // -= game is starting =-
     // ======================
-    
-    while (window.isOpen())
+
+    // the simulation ticks on its own thread and hands every finished tick to the render loop below as a
+    // snapshot, input goes the other way. both hand-overs are triple buffers: a display waiting on vsync
+    // never holds up a tick, and a slow tick never holds up the display, it just shows the last one again
+    TripleBuffer<InputState> input;
+    TripleBuffer<RenderSnapshot> frames;
+    std::atomic<uint64_t> framesDrawn{ 0 };
+    std::atomic<int> lastFrameMicros{ 0 };
+
+    std::thread simulation([&]()
     {
-        sf::Event event;
-        while (window.pollEvent(event))
+        sf::Clock tickClock;
+        uint32_t turboPresses{ 0 };
+        uint64_t framesSeen{ 0 };
+        particleBudget.owner = std::this_thread::get_id();
+        allocationTracker.enabled = config.trackAllocations;
+        while (true)
         {
-            if (event.type == sf::Event::Closed)
-                window.close();
-            if (event.type == sf::Event::KeyPressed)
+            AllocationScope phase(PHASE_INPUT);
+            ArenaScope frame(frameArena);
+            input.update();
+            const InputState& in = input.front();
+            if (in.quit) break;
+            while (turboPresses != in.turboPresses)
             {
-                if (event.key.code == sf::Keyboard::Escape)
-                {
-                    window.close();
-                }
+                turboPresses++;
+                config.turbo = !config.turbo;
+                LOG(Info, Input, "Turbo mode {}", config.turbo ? "on" : "off");
             }
-        }
-
-        sf::Vector2i mousePos = sf::Mouse::getPosition(window);
-        sf::Vector2f mousePosWorld = window.mapPixelToCoords(mousePos);
 
-        dt = frameClock.restart().asSeconds();
+            float dt = tickClock.restart().asSeconds();
+            // particles have to fit in whichever of the two loops is slower
+            float frameTime = lastFrameMicros.load(std::memory_order_relaxed) / 1000000.0f;
+            particleBudget.frameTime(std::max(dt, frameTime));
 
-        // meat and potatoes
+            // meat and potatoes
 
-		matchedTileCount = 0;
+            // process input
 
-        // process input
-
-        if (coyoteTime > 0)
-        {
-            coyoteTime -= dt;
-        }
-        else
-        {
-            coyoteTime = 0.0f;
-        }
+            if (coyoteTime > 0)
+            {
+                coyoteTime -= dt;
+            }
+            else
+            {
+                coyoteTime = 0.0f;
+            }
 
-        if (lockInput > 0)
-        {
-            lockInput -= dt;
-        }
-        else
-        {
-            lockInput = 0.0f;
-            // left mouse
-            if (sf::Mouse::isButtonPressed(sf::Mouse::Left))
+            if (lockInput > 0)
+            {
+                lockInput -= dt;
+            }
+            else
             {
-                lockInput = config.swapDuration;
-                for (int i = 0; i < grid.size(); i++)
+                lockInput = 0.0f;
+                // left mouse
+                if (in.left)
                 {
-                    if (grid[i].tileSprite.getGlobalBounds().contains(mousePosWorld))
+                    lockInput = config.swapDuration;
+                    for (int i = 0; i < grid.size(); i++)
                     {
-                        if (selectedTileIndex < 0)
-                        {
-                            grid[i].select();
-                            selectedTileIndex = i;
-                            lockInput = config.swapDuration;
-                            std::cout << "new selection: " << tileTypeToColor[(int)grid[i].type] << std::endl;
-                        }
-                        else
+                        if (grid[i].tileSprite.getGlobalBounds().contains(in.mouse))
                         {
-                            if (
-                                (grid[selectedTileIndex].tileSprite.getGlobalBounds().contains(grid[i].position + sf::Vector2f({ -config.tileWidth, 0 }))) // selected is to left of clicked
-                                || (grid[selectedTileIndex].tileSprite.getGlobalBounds().contains(grid[i].position + sf::Vector2f({ config.tileWidth, 0 }))) // selected is to right of clicked
-                                || (grid[selectedTileIndex].tileSprite.getGlobalBounds().contains(grid[i].position + sf::Vector2f({ 0, -config.tileWidth }))) // selected is above clicked
-                                || (grid[selectedTileIndex].tileSprite.getGlobalBounds().contains(grid[i].position + sf::Vector2f({ 0, config.tileWidth }))) // selected is below clicked
-                                )
+                            if (selectedTileIndex < 0)
                             {
-                                grid[i].move(grid[selectedTileIndex].position, config.swapDuration);
-                                grid[i].deselect();
-                                grid[selectedTileIndex].move(grid[i].position, config.swapDuration);
-                                grid[selectedTileIndex].deselect();
-                                swappedFromTileIndex = selectedTileIndex;
-                                swappedToTileIndex = i;
-                                swapMatchCheck = true;
-                                selectedTileIndex = -1;
+                                grid[i].select();
+                                selectedTileIndex = i;
                                 lockInput = config.swapDuration;
-                                std::cout << "swapped" << std::endl;
-                                if (grid[swappedFromTileIndex].type == Tile::TileType::BOMB)
-                                {
-                                    bombActive = true;
-                                }
+                                LOG(Debug, Input, "new selection: {}", tileTypeToColor[(int)grid[i].type]);
                             }
                             else
                             {
-                                grid[selectedTileIndex].deselect();
-                                grid[i].select();
-                                selectedTileIndex = i;
-                                lockInput = config.swapDuration;
-                                std::cout << "changed selection: "<< tileTypeToColor[(int)grid[i].type] << std::endl;
+                                if (
+                                    swappedFromCell < 0
+                                    && !grid[i].moving
+                                    && !grid[selectedTileIndex].moving
+                                    && logic.canSwap(grid[selectedTileIndex].cell, grid[i].cell)
+                                    )
+                                {
+                                    // logic catches up once the swap animation is done
+                                    grid[i].move(grid[selectedTileIndex].position, config.swapDuration);
+                                    grid[i].deselect();
+                                    grid[selectedTileIndex].move(grid[i].position, config.swapDuration);
+                                    grid[selectedTileIndex].deselect();
+                                    swappedFromCell = grid[selectedTileIndex].cell;
+                                    swappedToCell = grid[i].cell;
+                                    selectedTileIndex = -1;
+                                    lockInput = config.swapDuration;
+                                    LOG(Debug, Input, "swapped");
+                                }
+                                else
+                                {
+                                    grid[selectedTileIndex].deselect();
+                                    grid[i].select();
+                                    selectedTileIndex = i;
+                                    lockInput = config.swapDuration;
+                                    LOG(Debug, Input, "changed selection: {}", tileTypeToColor[(int)grid[i].type]);
+                                }
                             }
+                            break;
                         }
-                        break;
                     }
                 }
-            }
 
-            // right mouse
-            if (sf::Mouse::isButtonPressed(sf::Mouse::Right))
-            {
-                for (int i = 0; i < grid.size(); i++)
+                // right mouse
+                if (in.right)
                 {
-                    if (grid[i].tileSprite.getGlobalBounds().contains(mousePosWorld))
+                    for (int i = 0; i < grid.size(); i++)
                     {
-                        lockInput = config.swapDuration;
-                        std::cout << "Tile query: " << tileTypeToColor[(int)grid[i].type] 
-                            << " line: " << (int)(grid[i].position.y - config.miny + config.tileWidth/2) / (int)config.tileWidth 
-                            << " column: " << (int)(grid[i].position.x - config.minx + config.tileWidth/2) / (int)config.tileWidth 
-                            << " position: " << grid[i].position.x << ", " << grid[i].position.y 
-                            << std::endl;
+                        if (grid[i].tileSprite.getGlobalBounds().contains(in.mouse))
+                        {
+                            lockInput = config.swapDuration;
+                            LOG(Info, Input, "Tile query: {} line: {} column: {} position: {}, {}", tileTypeToColor[(int)grid[i].type],
+                                grid[i].cell / logic.board.width, grid[i].cell % logic.board.width, grid[i].position.x, grid[i].position.y);
+                        }
                     }
                 }
+
+                // space
+                if (in.space)
+                {
+                    lockInput = 0.2f;
+                    LOG(Info, Logic, "Match possible? {}", (int)matchPossible(logic.board));
+                }
             }
 
-            // space
-            if (sf::Keyboard::isKeyPressed(sf::Keyboard::Space))
+            stuffMoving = false;
+            for (int i = 0; i < grid.size(); i++)
             {
-                lockInput = 0.2f;
-                std::cout << "Match possible? " << matchPossible(grid, config) << std::endl;
+                if (grid[i].moving == true)
+                {
+                    stuffMoving = true;
+                    //std::cout << "Moving index: " << i << std::endl;
+                }
             }
+            //std::cout << "Stuffmoving: " << stuffMoving << std::endl;
 
-            // ESC
-            if (sf::Keyboard::isKeyPressed(sf::Keyboard::Escape))
+            // update: tiles have to be done before the logic looks at them, particles only before drawing
+            phase.enter(PHASE_EFFECTS);
+            jobs.parallelFor(grid.size(), 64, tilesUpdated, [&grid, dt](int begin, int end)
             {
-                break;
+                for (int i = begin; i < end; i++) grid[i].update(dt);
+            });
+            for (int i = 0; i < explosions.size(); i++)
+            {
+                ParticleSystem* system = explosions[i];
+                system->begin(dt);
+                jobs.parallelFor(system->particles.size(), 512, particlesUpdated, [system, dt](int begin, int end)
+                {
+                    system->integrate(dt, begin, end);
+                });
             }
-        }
+            jobs.wait(tilesUpdated);
 
-        stuffMoving = false;
-        for (int i = 0; i < grid.size(); i++)
-        {
-            if (grid[i].moving == true)
-            {
-                stuffMoving = true;
-                //std::cout << "Moving index: " << i << std::endl;
-            }
-        }
-        //std::cout << "Stuffmoving: " << stuffMoving << std::endl;
-
-        // update
-        for (int i = 0; i < grid.size(); i++)
-        {
-            grid[i].update(dt);
-        }
-        for (int i = 0; i < explosions.size(); i++)
-        {
-            explosions[i]->update(dt);
-        }
-
-        // match 3
-        if (!stuffMoving || coyoteTime > 0)
-        {
-			float minimumOffset = config.minx + 1.5 * config.tileWidth;
-
-            if (!bombActive)
-            {
-
-				for (int i = 0; i < grid.size(); i++)
-				{
-					int leftOne = i;
-					int leftTwo = i;
-					int topOne = i;
-					int topTwo = i;
-
-					for (int j = 0; j < grid.size(); j++)
-					{
-						if (grid[i].position.x >= minimumOffset)
-						{
-							if (i != j && ((int)(grid[i].position.y - config.miny + config.tileWidth / 2) / (int)config.tileWidth == ((int)(grid[j].position.y - config.miny + config.tileWidth / 2) / (int)config.tileWidth)) && grid[i] == grid[j])
-							{
-								if (grid[j].tileSprite.getGlobalBounds().contains(grid[i].position - sf::Vector2f({ config.tileWidth, 0 })))
-								{
-									leftOne = j;
-								}
-								if (grid[j].tileSprite.getGlobalBounds().contains(grid[i].position - sf::Vector2f({ 2 * config.tileWidth, 0 })))
-								{
-									leftTwo = j;
-								}
-							}
-						}
-
-						if (grid[i].position.y >= minimumOffset)
-						{
-							if (i != j && ((int)(grid[i].position.x - config.minx + config.tileWidth / 2) / (int)config.tileWidth == (int)(grid[j].position.x - config.minx + config.tileWidth / 2) / (int)(config.tileWidth)) && grid[i] == grid[j])
-							{
-								if (grid[j].tileSprite.getGlobalBounds().contains(grid[i].position - sf::Vector2f({ 0, config.tileWidth })))
-								{
-									topOne = j;
-								}
-								if (grid[j].tileSprite.getGlobalBounds().contains(grid[i].position - sf::Vector2f({ 0, 2 * config.tileWidth })))
-								{
-									topTwo = j;
-								}
-							}
-						}
-
-					}
-
-					if (leftOne != i && leftTwo != i && grid[leftOne] == grid[leftTwo])
-					{
-						grid[i].markForDeath();
-						grid[leftOne].markForDeath();
-						grid[leftTwo].markForDeath();
-						swapMatchCheck = false;
-						coyoteTime = 1.0f;
-						powerUpTracker++;
-						if (config.logging) std::cout << "Match horizontal " << tileTypeToColor[(int)grid[i].type] << std::endl;
-					}
-
-					if (topOne != i && topTwo != i && grid[topOne] == grid[topTwo])
-					{
-						grid[i].markForDeath();
-						grid[topOne].markForDeath();
-						grid[topTwo].markForDeath();
-						swapMatchCheck = false;
-						coyoteTime = 1.0f;
-						powerUpTracker++;
-						if (config.logging) std::cout << "Match vertical " << tileTypeToColor[(int)grid[i].type] << std::endl;
-					}
-				}
-            }
-            else
+            // game logic only moves on once everything on screen has come to rest
+            phase.enter(PHASE_LOGIC);
+            if (!stuffMoving)
             {
-                std::cout << "Bomb time!" << std::endl;
-                bombActive = false;
-                swapMatchCheck = false;
-                int bombIndex;
-                for (int i = 0; i < grid.size(); i++)
+                bool logicChanged{ false };
+
+                // turbo finishes off anything still pending from before it was switched on
+                if (config.turbo && (logic.collapseNeeded || logic.settlePending))
                 {
-                    if (grid[i].type == Tile::TileType::BOMB)
-                        bombIndex = i;
+                    logicChanged = true;
+                    cascade.clear();
+                    logic.resolve(cascade);
+                    recorder.cascade(cascade, logic.board.width, -1, -1);
+                    applyCascadeInstantly(grid, logic, cascade, config);
+                    selectedTileIndex = -1;
+                    coyoteTime = 0.0f;
                 }
-                grid[bombIndex].markForDeath();
-                for (int i = 0; i < grid.size(); i++)
+
+                // cascades (or a deadlock) left behind by the last collapse
+                step.clear();
+                if (logic.settle(step))
                 {
-                    if (i != bombIndex)
+                    logicChanged = true;
+                    recorder.settle();
+                    if (step.reshuffled) LOG(Info, Logic, "No moves left, reshuffling");
+                    if (step.reset) LOG(Info, Logic, "No moves left, new board");
+                    applyCascadeStep(grid, logic.board, step, config);
+                    if (step.scoreGained > 0)
                     {
-                        if (grid[i].tileSprite.getGlobalBounds().contains(grid[bombIndex].position + sf::Vector2f({ -config.tileWidth, -config.tileWidth }))) 
-                        {
-                            grid[i].markForDeath();
-                            continue;
-                        }
-                        if (grid[i].tileSprite.getGlobalBounds().contains(grid[bombIndex].position + sf::Vector2f({ 0, -config.tileWidth }))) 
-                        {
-                            grid[i].markForDeath();
-                            continue;
-                        }
-                        if (grid[i].tileSprite.getGlobalBounds().contains(grid[bombIndex].position + sf::Vector2f({ config.tileWidth, -config.tileWidth }))) 
-                        {
-                            grid[i].markForDeath();
-                            continue;
-                        }
-                        
-                        if (grid[i].tileSprite.getGlobalBounds().contains(grid[bombIndex].position + sf::Vector2f({ -config.tileWidth, 0 }))) 
-                        {
-                            grid[i].markForDeath();
-                            continue;
-                        }
-                        // own position
-                        if (grid[i].tileSprite.getGlobalBounds().contains(grid[bombIndex].position + sf::Vector2f({ config.tileWidth, 0 }))) 
-                        {
-                            grid[i].markForDeath();
-                            continue;
-                        }
-                        
-                        if (grid[i].tileSprite.getGlobalBounds().contains(grid[bombIndex].position + sf::Vector2f({ -config.tileWidth, config.tileWidth }))) 
+                        coyoteTime = 1.0f;
+                        LOG(Debug, Score, "Score to be added: {}", step.scoreGained);
+                        eventWatcher.notify(new Event(Event::EventType::EventMatch, step.scoreGained));
+                    }
+                }
+
+                // match 3
+                if (swappedFromCell >= 0)
+                {
+                    logicChanged = true;
+                    int fromTile = tileAtCell(grid, swappedFromCell);
+                    int toTile = tileAtCell(grid, swappedToCell);
+                    bool accepted{ false };
+                    step.clear();
+                    cascade.clear();
+                    if (config.turbo)
+                    {
+                        accepted = logic.resolveSwap(swappedFromCell, swappedToCell, cascade);
+                        recorder.cascade(cascade, logic.board.width, swappedFromCell, swappedToCell);
+                    }
+                    else
+                    {
+                        recorder.swap(logic.board.width, swappedFromCell, swappedToCell);
+                        accepted = logic.swap(swappedFromCell, swappedToCell, step);
+                    }
+
+                    if (accepted && config.turbo)
+                    {
+                        applyCascadeInstantly(grid, logic, cascade, config);
+                        selectedTileIndex = -1;
+                    }
+                    else if (accepted)
+                    {
+                        grid[fromTile].cell = swappedToCell;
+                        grid[toTile].cell = swappedFromCell;
+                        applyCascadeStep(grid, logic.board, step, config);
+                        if (step.detonated)
                         {
-                            grid[i].markForDeath();
-                            continue;
+                            LOG(Debug, Logic, "Special tile set off!");
                         }
-                        if (grid[i].tileSprite.getGlobalBounds().contains(grid[bombIndex].position + sf::Vector2f({ 0, config.tileWidth }))) 
+                        else
                         {
-                            grid[i].markForDeath();
-                            continue;
+                            coyoteTime = 1.0f;
                         }
-                        if (grid[i].tileSprite.getGlobalBounds().contains(grid[bombIndex].position + sf::Vector2f({ config.tileWidth, config.tileWidth }))) 
+                        if (step.scoreGained > 0)
                         {
-                            grid[i].markForDeath();
-                            continue;
+                            LOG(Debug, Score, "Score to be added: {}", step.scoreGained);
+                            eventWatcher.notify(new Event(Event::EventType::EventMatch, step.scoreGained));
                         }
-
-
                     }
+                    else
+                    {
+                        // reverse move if no match
+                        grid[fromTile].move(cellPosition(config, swappedFromCell % logic.board.width, swappedFromCell / logic.board.width), config.swapDuration);
+                        grid[toTile].move(cellPosition(config, swappedToCell % logic.board.width, swappedToCell / logic.board.width), config.swapDuration);
+                        lockInput += config.swapDuration;
+                    }
+                    swappedFromCell = -1;
+                    swappedToCell = -1;
                 }
-            }
 
-			// cleanup
-			for (int i = 0; i < grid.size(); i++)
-			{
-				if (grid[i].isDead())
-				{
-
-                    //create explosion
-                    ParticleProperties props;
-                    props.position = { grid[i].position };
-                    props.velocity = { 0, 0 };
-                    props.acceleration = { 0, 0 };
-                    props.lifetime = 0.5f;
-                    props.color = sf::Color::Yellow;
-                    props.textureCoords.a = { 0, 0 };
-                    props.textureCoords.b = { 47, 0 };
-                    props.textureCoords.c = { 47, 47 };
-                    props.textureCoords.d = { 0, 47 };
-                    props.size = { 2, 2 };
-                    props.startingAlpha = 256;
-                    props.endAlpha = 0;
-
-                    BaseEmitter* explosionEmitter = new ExplosionEmitter(props, 100);
-                    ParticleSystem* psExplosion = new ParticleSystem(props, explosionEmitter, 1.0f, textures.redTexture);
-                    psExplosion->emitter->init(*psExplosion);
-                    explosions.push_back(psExplosion);
-
-                    // game cleanup
-					grid.erase(grid.begin() + i);
-                    matchedTileCount++;
-					i--;
-					collapseNeeded = true;
-				}
-			}
+    			// cleanup
+    			for (int i = 0; i < grid.size(); i++)
+    			{
+    				if (grid[i].isDead())
+    				{
+
+                        //create explosion
+                        ParticleProperties props;
+                        props.position = { grid[i].position };
+                        props.velocity = { 0, 0 };
+                        props.acceleration = { 0, 0 };
+                        props.lifetime = 0.5f;
+                        props.color = sf::Color::Yellow;
+                        props.textureCoords.a = { 0, 0 };
+                        props.textureCoords.b = { 47, 0 };
+                        props.textureCoords.c = { 47, 47 };
+                        props.textureCoords.d = { 0, 47 };
+                        props.size = { 2, 2 };
+                        props.startingAlpha = 256;
+                        props.endAlpha = 0;
+
+                        // specials going off are what the player is watching, plain tiles give way first
+                        BaseEmitter* explosionEmitter = new ExplosionEmitter(props, 100, effectsRandom, isSpecialTile((int)grid[i].type) ? PRIORITY_IMPORTANT : PRIORITY_NORMAL);
+                        ParticleSystem* psExplosion = new ParticleSystem(props, explosionEmitter, 1.0f, textures.redTexture);
+                        psExplosion->emitter->init(*psExplosion);
+                        explosions.push_back(psExplosion);
+
+                        // game cleanup
+                        if (selectedTileIndex == i) selectedTileIndex = -1;
+                        if (selectedTileIndex > i) selectedTileIndex--;
+    					grid.erase(grid.begin() + i);
+    					i--;
+    				}
+    			}
+
+    			// collapse
+    			if (logic.collapseNeeded && coyoteTime <= 0.0f)
+    			{
+    				LOG(Debug, Logic, "Collapse required");
+                    step.clear();
+                    logic.collapse(step);
+                    recorder.collapse();
+                    applyCascadeStep(grid, logic.board, step, config);
+                    logicChanged = true;
+    			}
+
+                if (logicChanged && autosaveSlot)
+                {
+                    autosaveSlot->capture(logic, config, scoreboard.score, coyoteTime, effectsRandom);
+                }
+            }
 
+            phase.enter(PHASE_EFFECTS);
             for (int i = 0; i < explosions.size(); i++)
             {
                 if (explosions[i]->isDead())
@@ -1463,116 +8226,89 @@ int main()
                 }
             }
 
-            if (matchedTileCount >= 3)
-            {
-                if (gridResetRequired)
-                {
-                    gridResetRequired = false;
-                }
-                else
-                {
-                    std::cout << "Score to be added: " << matchedTileCount - 2 << std::endl;
-                    eventWatcher.notify(new Event(Event::EventType::EventMatch, matchedTileCount - 2));
-                }
-            }
+            jobs.wait(particlesUpdated);
 
-			// collapse
-			if (collapseNeeded && coyoteTime <= 0.0f)
-			{
-				std::cout << "Collapse required" << std::endl;
-                collapseNeeded = false;
-				for (int i = 0; i < config.gridWidth; i++)
-				{
-					int needed{ 0 };
-
-					for (int j = config.gridHeight - 1; j >= 0; j--)
-					{
-						bool found{ false };
-
-						for (int k = 0; k < grid.size(); k++)
-						{
-							if (grid[k].tileSprite.getGlobalBounds().contains(sf::Vector2f(config.minx + i * config.tileWidth, config.miny + j * config.tileWidth)))
-							{
-								found = true;
-								grid[k].move(sf::Vector2f({ config.minx + i * config.tileWidth, config.miny + (j + needed) * config.tileWidth }), config.swapDuration);
-							}
-						}
-
-						if (!found)
-						{
-							needed++;
-						}
-					}
-
-                    // generate tiles required to fill grid
-					if (needed > 0) std::cout << "Needed tiles: " << needed << std::endl;
-					for (int l = 1; l <= needed; l++)
-					{
-                        std::vector<int> possibleTypes;
-                        for (int k = 0; k < config.tileTypes; k++) possibleTypes.push_back(k);
-                        possibleTypes.pop_back(); // remove bomb tile
-                        possibleTypes.pop_back(); // remove wildcard tile
-                        int selector = rand() % possibleTypes.size();
-                        createdTiles+=1.0f;
-                        if ((rand() % 100) >= 95)
-                        {
-                            selector = (int)Tile::TileType::WILDCARD;
-                            createdWildcardTiles+=1.0f;
-                        }
-                        if (powerUpTracker >= config.powerUpBomb)
-                        {
-                            selector = (int)Tile::TileType::BOMB;
-                            powerUpTracker = 0;
-                        }
-                        //std::cout << "Wildcard tiles: " << createdWildcardTiles<<"/"<< createdTiles << "%" << std::endl;
-						Tile::TileType t = Tile::TileType(selector);
-						Tile tile(t, sf::Vector2f({ config.minx + i * config.tileWidth, config.miny - l * config.tileWidth }), sf::Vector2f({ config.tileWidth, config.tileWidth }));
-						tile.move(sf::Vector2f({ config.minx + i * config.tileWidth, config.miny + (needed - l) * config.tileWidth }), (1 + 2*i/config.gridWidth + (float)l/needed) * config.swapDuration);
-						grid.push_back(tile);
-					}
-				}
-			}
+            phase.enter(PHASE_PUBLISH);
+            frames.back().capture(grid, explosions, scoreboard.score);
+            frames.publish();
 
-            if (!matchPossible(grid, config))
+            uint64_t drawn = framesDrawn.load(std::memory_order_relaxed);
+            if (drawn != framesSeen)
             {
-                //fillNewGrid(grid, config);
-                for (int i = 0; i < grid.size(); i++)
-                {
-                    grid[i].markForDeath();
-                    gridResetRequired = true;
-                }
+                framesSeen = drawn;
+                telemetry.frameMicros.add(lastFrameMicros.load(std::memory_order_relaxed));
             }
+            telemetry.frames = drawn;
+            telemetry.ticks++;
+            telemetry.tickMicros.add((uint64_t)(dt * 1000000.0f));
+            telemetry.particlesAlive = particleBudget.alive;
+            telemetry.particleQuality = (int64_t)(particleBudget.quality * 100.0f + 0.5f);
+            telemetry.score = scoreboard.score;
+            telemetry.heapBytes = heapCounter.bytes.load(std::memory_order_relaxed);
+            telemetry.heapBlocks = heapCounter.blocks.load(std::memory_order_relaxed);
+            telemetry.tilesCreated = (uint64_t)logic.spawner.createdTiles;
+            telemetry.wildcardsCreated = (uint64_t)logic.spawner.createdWildcardTiles;
+            telemetry.logRecordsDropped = logger.droppedRecords();
+            telemetryExport.publish(telemetry);
+            if (config.trackAllocations) allocationTracker.endFrame();
+
+            // ticks much faster than the display are never seen, no need to burn a core on them
+            float spare = config.tickTime - tickClock.getElapsedTime().asSeconds();
+            if (spare > 0.0f) std::this_thread::sleep_for(std::chrono::microseconds((int)(spare * 1000000.0f)));
+        }
+    });
 
-            // reverse move if no match
-            if (swapMatchCheck && lockInput == 0.0f)
+    uint32_t turboPresses{ 0 };
+    bool quit{ false };
+    while (!quit)
+    {
+        sf::Event event;
+        while (window.pollEvent(event))
+        {
+            if (event.type == sf::Event::Closed) quit = true;
+            if (event.type == sf::Event::KeyPressed)
             {
-                grid[swappedFromTileIndex].move(grid[swappedToTileIndex].position, config.swapDuration);
-                grid[swappedToTileIndex].move(grid[swappedFromTileIndex].position, config.swapDuration);
-                lockInput += config.swapDuration;
-                swapMatchCheck = false;
+                if (event.key.code == sf::Keyboard::Escape) quit = true;
+                if (event.key.code == sf::Keyboard::T) turboPresses++;
             }
         }
 
-        // drawing
-        scoreText.setString(std::to_string(scoreboard.score));
+        InputState& next = input.back();
+        next.mouse = window.mapPixelToCoords(sf::Mouse::getPosition(window));
+        next.left = sf::Mouse::isButtonPressed(sf::Mouse::Left);
+        next.right = sf::Mouse::isButtonPressed(sf::Mouse::Right);
+        next.space = sf::Keyboard::isKeyPressed(sf::Keyboard::Space);
+        next.turboPresses = turboPresses;
+        next.quit = quit;
+        input.publish();
+
+        float frameTime = frameClock.restart().asSeconds();
+        lastFrameMicros.store((int)(frameTime * 1000000.0f), std::memory_order_relaxed);
+        frames.update();
+        const RenderSnapshot& snapshot = frames.front();
+        scoreCounter.set(snapshot.score);
+        scoreCounter.update(frameTime);
 
+        // drawing
         window.clear();
         //window.draw(cornerCheck);
         window.draw(gameAssets.backgroundSprite);
         window.draw(gameAssets.scoreSprite);
-        for (int i = 0; i < grid.size(); i++)
-        {
-            window.draw(grid[i]);
-        }
-        for (int i = 0; i < explosions.size(); i++)
-        {
-            window.draw(*explosions[i]);
-        }
-
-        window.draw(scoreText);
-        window.draw(helpText);
+        window.draw(snapshot);
+        window.draw(hud);
         window.display();
+        framesDrawn.fetch_add(1, std::memory_order_relaxed);
     }
+    simulation.join();
+    window.close();
+
+    if (config.recordReplay)
+    {
+        recorder.save(config.replayPath, scoreboard.score);
+        LOG(Info, System, "Replay saved to {}", config.replayPath);
+    }
+    if (config.trackAllocations) LOG(Info, System, "Most heap allocations in one frame: {}", allocationTracker.worstFrame.load());
+    logger.stop();
 
     return 0;
-}
\ No newline at end of file
+}